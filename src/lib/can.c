@@ -6,8 +6,12 @@
  *
  *The CPC-USB CAN device can read and write can messages using a cusom API delivered by EMS Wuensche, the producer of this hardware unit. This library acts as a wrapper to that API to allow simple usage of that unit. It delivers functions for initialization, reading and writing of CAN messages.
  *
- * \author Sascha Kolski  
- * \date February 2006 
+ *Alternatively, a bus may be accessed through the kernel's SocketCAN stack. Received frames are then converted into CPC messages, such that the same message handlers serve both backends.
+ *
+ *The state of each bus is kept in its own context (CAN_BUS). The functions taking a bus number are wrappers for the respective context functions.
+ *
+ * \author Sascha Kolski
+ * \date February 2006
  *
  */
 
@@ -19,9 +23,18 @@
 #include <ctype.h>
 #include <sys/file.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <termios.h>
+#include <errno.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <stddef.h>
 
 #include <libelrob/Edebug.h>
 
@@ -29,258 +42,1609 @@
 #include "can.h"
 #include "lss.h"
 #include "handlers.h"
+#include "trace.h"
+#include "virtual.h"
+
+/*! Partitions of at most this number of identifiers onto the two SJA1000
+    filters are searched exhaustively */
+#define LIBCAN_FILTER_EXHAUSTIVE_IDS 12
+
+static CAN_CLOCK can_clock = 0;
+static void *can_clock_data = 0;
 
+int can_active[LIBCAN_MAX_CAN];
 
-/*! Macros for watching on a CAN channel. */
-#define SELECT    FD_ZERO(&readfds);		  \
-                  FD_SET(0, &readfds);            \
-                  FD_SET(cpcfd, &readfds);	      \
-                  tv.tv_sec  = 0;	                \
-                  tv.tv_usec = 500000;	/*500000*/ /*2000*/      \
-                  nfds = select(cpcfd+1, &readfds, NULL, NULL, &tv);
-
-/*! Macros for watching on write on a CAN channel. */
-#define SELECT_WR FD_ZERO(&writefds);                                 \
-                  /*FD_SET(0, &readfds);*/         \
-                  FD_SET(0, &readfds);                                 \
-                  FD_SET(0, &writefds);                                \
-                  FD_SET(cpcfd, &writefds);                           \
-                  tv.tv_sec  = 0;                                     \
-                  tv.tv_usec = 500000;                                \
-                  nfds = select(cpcfd+1, NULL, &writefds, NULL, &tv);
-
-static unsigned char       btr0,btr1;
-static int                 handle;
-static int                 handle_array[LIBCAN_MAX_CAN]; 
-static char                interface[32];  
-static int                 zchn, nfds;
-static int                 cpcfd_array[LIBCAN_MAX_CAN];
-static int                 cpcfd;
-static CPC_INIT_PARAMS_T * CPCInitParamsPtr;
-static fd_set              readfds, writefds;
-static struct timeval      tv;
+/* The RX ring and TX queue synchronization lives as long as the busses,
+   it is never destroyed */
+static CAN_BUS can_busses[LIBCAN_MAX_CAN] = {
+  [0 ... LIBCAN_MAX_CAN-1] = {
+    .tx_queue = {
+      .mutex = PTHREAD_MUTEX_INITIALIZER,
+      .cond = PTHREAD_COND_INITIALIZER,
+    },
+    .rx_ring = {.mutex = PTHREAD_MUTEX_INITIALIZER},
+  },
+};
 
 /*!
  *
- * \brief sends a standard CAN message
+ * \brief checks the length of a message to be sent
  *
- * \param busId CAN bus to send the message on
- * \param can_id Identifier of the CAN message
- * \param *msg Pointer to the 8byte content of the CAN message
- * 
  */
+static EBOOL can_valid_length(int length)
+{
+  return (length >= 0) && (length <= 8);
+}
 
-int my_send_can_message(int busId, int can_id, char *msg) {
-  CPC_CAN_MSG_T cmsg = {0x00L, 0, {0, 0, 0, 0, 0, 0, 0, 0}};
-  struct timeval time;
-  fd_set set;
-  int i, error;
+void canBusReceive(CAN_BUS *bus, const CPC_MSG_T *cpcmsg)
+{
+  CAN_RX_RING *ring = &bus->rx_ring;
+  unsigned int head, fill;
 
-  cpcfd = cpcfd_array[busId];
-  handle = handle_array[busId];
+  canTraceMessage(bus->busId, cpcmsg);
 
-  cmsg.id = can_id;
-  cmsg.length = 8;
-  memcpy(cmsg.msg, msg, 8);
+  if (!bus->reader_running) {
+    canBusDispatch(bus, cpcmsg);
+    return;
+  }
 
-  time.tv_sec = 0;
-  time.tv_usec = LIBCAN_TIMEOUT*1e6;
+  head = ring->head;
+  fill = head-__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (fill == ring->size) {
+    ++bus->stats.rx_overruns;
+    return;
+  }
+  if (fill >= ring->max_fill)
+    ring->max_fill = fill+1;
 
-  FD_ZERO(&set);
-  FD_SET(cpcfd, &set);
+  /* Only the header and the CAN message part of the union are relevant */
+  memcpy(&ring->messages[head & (ring->size-1)], cpcmsg,
+    offsetof(CPC_MSG_T, msg)+sizeof(CPC_CAN_MSG_T));
+  __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
 
-  error = select(cpcfd+1, NULL, &set, NULL, &time);
-  if (error == 0)
-    return -1;
+/*!
+ *
+ * \brief compares the transmission priority of two queued messages
+ *
+ * Lower CAN identifiers win the bus arbitration and are sent first,
+ * messages with equal identifiers are sent in the order of queueing.
+ *
+ */
+static int can_tx_before(const CAN_TX_ENTRY *a, const CAN_TX_ENTRY *b)
+{
+  return (a->message.id < b->message.id) || ((a->message.id ==
+    b->message.id) && ((long)(a->sequence-b->sequence) < 0));
+}
 
-  while ((error = CPC_SendMsg(handle, 0, &cmsg)) == CPC_ERR_CAN_NO_TRANSMIT_BUF)
-    usleep(10);
+/*!
+ *
+ * \brief restores the heap property of a TX queue around an entry
+ *
+ */
+static void can_tx_sift(CAN_TX_QUEUE *queue, unsigned int i)
+{
+  CAN_TX_ENTRY *entries = queue->entries, entry = entries[i];
+  unsigned int child;
 
-  return error;
+  while ((i > 0) && can_tx_before(&entry, &entries[(i-1)/2])) {
+    entries[i] = entries[(i-1)/2];
+    i = (i-1)/2;
+  }
+  while ((child = 2*i+1) < queue->count) {
+    if ((child+1 < queue->count) &&
+        can_tx_before(&entries[child+1], &entries[child]))
+      ++child;
+    if (!can_tx_before(&entries[child], &entry))
+      break;
+    entries[i] = entries[child];
+    i = child;
+  }
+  entries[i] = entry;
 }
 
 /*!
  *
- * \brief sends a variable length CAN message
+ * \brief removes an entry from a TX queue
  *
- * \param busId CAN bus to send the message on
- * \param can_id Identifier of the CAN message
- * \param length Length of the CAN message 
- * \param *msg Pointer to the content of the CAN message
- * 
- * 
  */
-void my_send_can_message_var_length(int busId, int can_id, int length, char *msg)
- {
-   static CPC_CAN_MSG_T cmsg = {0x00L,0,{0,0,0,0,0,0,0,0}};
-   int i;
-   
-   cpcfd = cpcfd_array[busId];
-   handle = handle_array[busId];
-
-   cmsg.id=can_id;
-   cmsg.length=length;
-
-    for(i=0;i<cmsg.length;i++){
-     cmsg.msg[i] = (unsigned char)msg[i];
-    } 
-    
-    SELECT_WR
-      if(FD_ISSET(cpcfd, &writefds)){
-	CPC_SendMsg(handle, 0, &cmsg);
-      }
- }
+static void can_tx_remove(CAN_TX_QUEUE *queue, unsigned int i)
+{
+  if (i < --queue->count) {
+    queue->entries[i] = queue->entries[queue->count];
+    can_tx_sift(queue, i);
+  }
+}
 
 /*!
  *
- * \brief reads a CAN message
- *
- * This function is waiting for a CAN message in the given bus. If a message arrives all registered message handlers 
- * are called one after the other. If no message is available after a time defined in SELECT, the function returns 
- * without calling any message handler. 
+ * \brief writer thread sending the messages of the TX queue
  *
- * \param busId CAN bus to read from
- * 
- * 
  */
-EBOOL read_can_message(int busId)
+static void* can_bus_writer(void *arg)
 {
-  cpcfd = cpcfd_array[busId];
-  handle = handle_array[busId];  /* task for reading can */
-  SELECT 
-    
-  //EDBG("nfds= %d\n",nfds);
-
-  if(nfds>0)
-      {
-	// check, if messages have been received
-	if(FD_ISSET(cpcfd, &readfds))
-	  {
-	    do{
-	      /*EPRINT(".");*/
-	    }
-	    while(CPC_Handle(handle));
-	    //EDBG(":\n");
-	  }
-	else
-	  {
-	    //EDBG("NO READING POSSIBLE from can bus %d\n", busId);
-	    return EFALSE;
-	  }
-      }    
-    else
-      {
-	EDBG("nothing to read...from can bus %d\n", busId);
-	if(nfds == -1)
-	  perror(interface);
+  CAN_BUS *bus = arg;
+  CAN_TX_QUEUE *queue = &bus->tx_queue;
+  CAN_TX_ENTRY entry;
 
-	/*if(nfds == 0)
-	  EDBG("Timeout");*/
+  pthread_mutex_lock(&queue->mutex);
+  while (bus->writer_running) {
+    if (!queue->count) {
+      pthread_cond_wait(&queue->cond, &queue->mutex);
+      continue;
+    }
 
-	return EFALSE;
-      }
+    entry = queue->entries[0];
+    can_tx_remove(queue, 0);
+    pthread_mutex_unlock(&queue->mutex);
 
-  return ETRUE;
-}
+    if (entry.deadline && (canGetTime() > entry.deadline))
+      ++bus->stats.tx_stale;
+    else
+      canBusSend(bus, entry.message.id, entry.message.length,
+        (const char*)entry.message.msg);
 
-int canHWCleanup(int busId){
-	return CPC_CloseChannel(handle_array[busId]);
+    pthread_mutex_lock(&queue->mutex);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
 }
 
+/*!
+ *
+ * \brief code and mask matching a group of standard CAN identifiers
+ *
+ * \return The number of identifiers accepted by the resulting filter
+ *
+ */
+static int can_filter_group(const int *can_ids, int num_ids, unsigned int
+  group, int *code, int *mask)
+{
+  int i, first = -1;
+
+  *code = 0;
+  *mask = 0;
+  for (i = 0; i < num_ids; ++i)
+    if (group & (1U << i)) {
+      if (first < 0)
+        *code = can_ids[first = i];
+      *mask |= can_ids[i] ^ *code;
+    }
+
+  return (first < 0) ? 0 : 1 << __builtin_popcount(*mask);
+}
 
 /*!
  *
- * \brief Init CAN bus access
+ * \brief code and mask matching a range of standard CAN identifiers
  *
- * Initializes a given CAN bus. 
+ * \return The number of identifiers accepted by the resulting filter
  *
- * \param busId CAN bus Number
- * \param bitrate Bitrate for the communication in Kbaud (supprted bitrates are 100, 250, 500 and 1000)
- * \param *can_device Device to connect to (eg: /dev/usb/cpc_usb0)
- * 
  */
-int canHWInit(int busId, int bitrate, char *can_device)
+static int can_filter_range(const int *can_ids, int begin, int end, int
+  *code, int *mask)
 {
-  //EDBG_DISABLE();
-  EDBG("Starting CANHWInit...");
-  EDBG("configuring port %d with %d baud",busId,bitrate);
-  switch (bitrate){
-  case 1000:
-    /* Bitrate 1 Mbit */
-    btr0=0x00;
-    btr1=0x14;
-    break;
-  case 250:
-    /* Bitrate 250 Kbit */
-    btr0=0x01;
-    btr1=0x1c;
-    break;
-  case 500:
-    /* Baudrate 500 used for smart */
+  int i;
 
-    btr0=0x00;
-    btr1=0x1c;
-    break;
-  case 100:
-    btr0=0x04;
-    btr1=0x1c;
-    break;
-  }
+  *code = can_ids[begin];
+  *mask = 0;
+  for (i = begin+1; i < end; ++i)
+    *mask |= can_ids[i] ^ *code;
 
-  strcpy(interface, can_device);
+  return 1 << __builtin_popcount(*mask);
+}
 
-  /*Open the CAN*/
-  if((handle_array[busId] = CPC_OpenChannel(interface)) < 0)
-    {
-      EDBG("ERROR: %s\n", CPC_DecodeErrorMsg(handle_array[busId]));
-      return -1;
-    }
-  EDBG("%s is CAN interface -> handle %d\n", interface, handle_array[busId]);
+/*!
+ *
+ * \brief applies the software filter of a SocketCAN socket
+ *
+ */
+static int can_socket_set_filter(CAN_BUS *bus)
+{
+  struct can_filter filters[LIBCAN_MAX_FILTER_IDS];
+  int i;
 
-  /* ############################# Init Parameters ######################*/
-  
-  /*Define Handlers*/
-  CPC_AddHandler(handle_array[busId], get_speed_msg_handler);
-  CPC_AddHandler(handle_array[busId], get_steering_msg_handler);
-  CPC_AddHandler(handle_array[busId], get_pedal_msg_handler);
-  CPC_AddHandler(handle_array[busId], get_wheel_speeds_msg_handler);
-  CPC_AddHandler(handle_array[busId], lss_get_msg_handler);
+  if (!bus->filter_set) {
+    /* A single filter without any relevant bit accepts all messages */
+    filters[0].can_id = 0;
+    filters[0].can_mask = 0;
+    return setsockopt(bus->fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+      sizeof(struct can_filter));
+  }
+
+  for (i = 0; i < bus->num_filter_ids; ++i) {
+    filters[i].can_id = bus->filter_ids[i];
+    filters[i].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+  }
+  return setsockopt(bus->fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+    bus->num_filter_ids*sizeof(struct can_filter));
+}
+
+/*!
+ *
+ * \brief initializes the CAN controller behind a CPC channel
+ *
+ * Applies the bit timing and the acceptance filter of the bus and switches
+ * on the transmission of CAN messages from the CPC to the PC.
+ *
+ */
+static int can_cpc_init_controller(CAN_BUS *bus)
+{
+  CAN_ACCEPTANCE_FILTER accept_all = {{0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff}};
+  CAN_ACCEPTANCE_FILTER *filter = bus->filter_set ? &bus->acc_filter :
+    &accept_all;
+  CPC_INIT_PARAMS_T *CPCInitParamsPtr;
+  unsigned char confirm;
+  int reply;
 
   /* This sets up the parameters used to initialize the CAN controller */
   EDBG("Initializing CAN-Controller ... ");
-  
-  CPCInitParamsPtr = CPC_GetInitParamsPtr(handle_array[busId]);
+
+  pthread_mutex_lock(&bus->tx_mutex);
+  CPCInitParamsPtr = CPC_GetInitParamsPtr(bus->handle);
   CPCInitParamsPtr->canparams.cc_type                      = SJA1000;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.btr0       = btr0;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.btr1       = btr1;
+  CPCInitParamsPtr->canparams.cc_params.sja1000.btr0       = bus->btr0;
+  CPCInitParamsPtr->canparams.cc_params.sja1000.btr1       = bus->btr1;
   CPCInitParamsPtr->canparams.cc_params.sja1000.outp_contr = 0xda;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code0  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code1  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code2  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code3  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask0  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask1  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask2  = 0xff;
-  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask3  = 0xff;
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code0  = filter->code[0];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code1  = filter->code[1];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code2  = filter->code[2];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_code3  = filter->code[3];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask0  = filter->mask[0];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask1  = filter->mask[1];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask2  = filter->mask[2];
+  CPCInitParamsPtr->canparams.cc_params.sja1000.acc_mask3  = filter->mask[3];
+  /* Dual filter mode */
   CPCInitParamsPtr->canparams.cc_params.sja1000.mode       = 0;
 
-  unsigned char confirm;
   confirm = 0;
-  int reply;
-
-  reply = CPC_CANInit(handle_array[busId], confirm);
+  reply = CPC_CANInit(bus->handle, confirm);
   EDBG(" init said: %d,%d Done!\n\n",reply,confirm);
 
-  cpcfd_array[busId] = CPC_GetFdByHandle(handle);
-  
-  EDBG("cpcfd= %d\n",cpcfd_array[busId]);
-
   EDBG("Switch ON transimssion of CAN messages from CPC to PC\n");
 
   /* switch on transmission of CAN messages from CPC to PC */
-  CPC_Control(handle_array[busId], CONTR_CAN_Message | CONTR_CONT_ON);
+  CPC_Control(bus->handle, CONTR_CAN_Message | CONTR_CONT_ON);
+  pthread_mutex_unlock(&bus->tx_mutex);
+
+  return reply;
+}
+
+/*!
+ *
+ * \brief converts the receive timestamp of a message into the monotonic
+ *   clock domain
+ *
+ * Receive timestamps of the CPC driver and the SocketCAN kernel stamps are
+ * taken from the realtime clock, which may jump. They are shifted by the
+ * current offset between the two clocks. Messages without a timestamp are
+ * stamped with the current monotonic time.
+ *
+ */
+static void can_stamp_message(CPC_MSG_T *cpcmsg, long sec, long nsec)
+{
+  struct timespec mono, real;
+
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  if (sec || nsec) {
+    clock_gettime(CLOCK_REALTIME, &real);
+    sec += mono.tv_sec-real.tv_sec;
+    nsec += mono.tv_nsec-real.tv_nsec;
+    while (nsec < 0) {
+      nsec += 1000000000L;
+      --sec;
+    }
+    while (nsec >= 1000000000L) {
+      nsec -= 1000000000L;
+      ++sec;
+    }
+    /* A timestamp from the future is clamped to the current time */
+    if ((sec > mono.tv_sec) ||
+        ((sec == mono.tv_sec) && (nsec > mono.tv_nsec))) {
+      sec = mono.tv_sec;
+      nsec = mono.tv_nsec;
+    }
+  }
+  else {
+    sec = mono.tv_sec;
+    nsec = mono.tv_nsec;
+  }
+
+  cpcmsg->ts_sec = sec;
+  cpcmsg->ts_nsec = nsec;
+}
+
+/*!
+ *
+ * \brief passes a message received through the CPC API to the dispatcher
+ *
+ * The CPC API identifies the bus by its channel handle which is mapped
+ * back onto the bus context here.
+ *
+ */
+static void can_cpc_dispatch(int handle, const CPC_MSG_T *cpcmsg)
+{
+  CPC_MSG_T message;
+  int busId;
+
+  for (busId = 0; busId < LIBCAN_MAX_CAN; ++busId)
+    if (can_busses[busId].active &&
+        (can_busses[busId].comType != SMART_CAN_COM_SOCKET) &&
+        (can_busses[busId].handle == handle)) {
+      /* Only the header and the CAN message part of the union are
+         relevant */
+      memcpy(&message, cpcmsg, offsetof(CPC_MSG_T, msg)+
+        sizeof(CPC_CAN_MSG_T));
+      can_stamp_message(&message, message.ts_sec, message.ts_nsec);
+      canBusReceive(&can_busses[busId], &message);
+      break;
+    }
+}
+
+/*!
+ *
+ * \brief waits for at most LIBCAN_TIMEOUT for a CPC channel to become
+ *   writable
+ *
+ * \return 0 on success, -1 on timeout
+ *
+ */
+static int can_cpc_wait(CAN_BUS *bus)
+{
+  struct timeval time;
+  fd_set set;
+
+  time.tv_sec = 0;
+  time.tv_usec = LIBCAN_TIMEOUT*1e6;
+
+  FD_ZERO(&set);
+  FD_SET(bus->fd, &set);
+
+  if (select(bus->fd+1, NULL, &set, NULL, &time) == 0) {
+    ++bus->stats.tx_timeouts;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*!
+ *
+ * \brief passes a CAN message to the CPC API
+ *
+ * While the transmit buffer of the device is full, it is polled for at
+ * most LIBCAN_TIMEOUT.
+ *
+ * \return 0 on success, a negative value on failure or timeout
+ *
+ */
+static int can_cpc_write(CAN_BUS *bus, CPC_CAN_MSG_T *cmsg)
+{
+  double deadline = 0.0;
+  int error;
+
+  while ((error = CPC_SendMsg(bus->handle, 0, cmsg)) ==
+      CPC_ERR_CAN_NO_TRANSMIT_BUF) {
+    if (!deadline)
+      deadline = canGetTime()+LIBCAN_TIMEOUT;
+    else if (canGetTime() > deadline) {
+      ++bus->stats.tx_timeouts;
+      break;
+    }
+    usleep(10);
+  }
+
+  return error;
+}
+
+/*!
+ *
+ * \brief sends a CAN message through the CPC API
+ *
+ * Waits for at most LIBCAN_TIMEOUT for the channel to become writable.
+ *
+ * \return 0 on success, a negative value on failure or timeout
+ *
+ */
+static int can_cpc_send(CAN_BUS *bus, int can_id, int length,
+  const char *msg)
+{
+  CPC_CAN_MSG_T cmsg = {0x00L, 0, {0, 0, 0, 0, 0, 0, 0, 0}};
+
+  cmsg.id = can_id;
+  cmsg.length = length;
+  memcpy(cmsg.msg, msg, length);
+
+  if (can_cpc_wait(bus))
+    return -1;
+
+  return can_cpc_write(bus, &cmsg);
+}
+
+/*!
+ *
+ * \brief sends an array of CAN messages through the CPC API
+ *
+ * The channel is waited for once, the messages are then passed to the
+ * device back to back.
+ *
+ * \return The number of messages sent
+ *
+ */
+static int can_cpc_send_batch(CAN_BUS *bus, const CPC_CAN_MSG_T *messages,
+  int count, int *status)
+{
+  CPC_CAN_MSG_T cmsg;
+  int i, sent = 0;
+
+  if (can_cpc_wait(bus)) {
+    for (i = 0; i < count; ++i)
+      status[i] = -1;
+    return 0;
+  }
+
+  for (i = 0; i < count; ++i) {
+    cmsg = messages[i];
+    if (!(status[i] = can_cpc_write(bus, &cmsg) ? -1 : 0))
+      ++sent;
+  }
+
+  return sent;
+}
+
+/*!
+ *
+ * \brief reads CAN messages through the CPC API
+ *
+ * Waits for at most LIBCAN_READ_TIMEOUT for messages to arrive.
+ *
+ */
+static EBOOL can_cpc_read(CAN_BUS *bus)
+{
+  struct timeval tv;
+  fd_set readfds;
+  int nfds;
+
+  FD_ZERO(&readfds);
+  FD_SET(bus->fd, &readfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = LIBCAN_READ_TIMEOUT*1e6;
+
+  nfds = select(bus->fd+1, &readfds, NULL, NULL, &tv);
+  if (nfds > 0) {
+    while (CPC_Handle(bus->handle));
+    return ETRUE;
+  }
+
+  if (nfds < 0) {
+    ++bus->stats.rx_errors;
+    perror(bus->device);
+  }
+  else
+    EDBG("nothing to read...from can bus %d\n", bus->busId);
+
+  return EFALSE;
+}
+
+/*!
+ *
+ * \brief opens and binds a raw SocketCAN socket
+ *
+ * \param *device Network interface to bind the socket to (eg: can0)
+ * \return The socket descriptor or -1 on failure
+ *
+ */
+static int can_socket_open(char *device)
+{
+  struct sockaddr_can addr;
+  struct ifreq ifr;
+  struct timeval timeout;
+  int fd, enable = 1;
+
+  if ((fd = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+    perror(device);
+    return -1;
+  }
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+    EDBG("ERROR: no such CAN interface %s\n", device);
+    close(fd);
+    return -1;
+  }
+
+  timeout.tv_sec = 0;
+  timeout.tv_usec = LIBCAN_READ_TIMEOUT*1e6;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror(device);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*!
+ *
+ * \brief sends a CAN message through a SocketCAN socket
+ *
+ * If the socket's transmit queue is full, the function waits for at most
+ * LIBCAN_TIMEOUT for the queue to drain.
+ *
+ * \return 0 on success, -1 on failure or timeout
+ *
+ */
+static int can_socket_send(CAN_BUS *bus, int can_id, int length,
+  const char *msg)
+{
+  struct can_frame frame;
+  struct pollfd pfd;
+  int timeout = LIBCAN_TIMEOUT*1e3;
+
+  memset(&frame, 0, sizeof(frame));
+  frame.can_id = can_id;
+  frame.can_dlc = length;
+  memcpy(frame.data, msg, length);
+
+  pfd.fd = bus->fd;
+  pfd.events = POLLOUT;
+
+  while (write(pfd.fd, &frame, sizeof(frame)) != sizeof(frame)) {
+    if ((errno != ENOBUFS) && (errno != EAGAIN) && (errno != EINTR))
+      return -1;
+    /* POLLOUT may be signaled although the device queue is still full */
+    if ((timeout-- <= 0) || (poll(&pfd, 1, 1) < 0)) {
+      ++bus->stats.tx_timeouts;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*!
+ *
+ * \brief sends an array of CAN messages through a SocketCAN socket
+ *
+ * The messages are submitted in chunks of LIBCAN_MAX_BATCH frames with one
+ * system call each. If the socket's transmit queue is full, the function
+ * waits for at most LIBCAN_TIMEOUT for the queue to drain.
+ *
+ * \return The number of messages sent
+ *
+ */
+static int can_socket_send_batch(CAN_BUS *bus,
+  const CPC_CAN_MSG_T *messages, int count, int *status)
+{
+  struct can_frame frames[LIBCAN_MAX_BATCH];
+  struct iovec iov[LIBCAN_MAX_BATCH];
+  struct mmsghdr headers[LIBCAN_MAX_BATCH];
+  struct pollfd pfd;
+  int timeout = LIBCAN_TIMEOUT*1e3;
+  int i, n, chunk, sent = 0;
+
+  pfd.fd = bus->fd;
+  pfd.events = POLLOUT;
+
+  for (i = 0; i < count; ++i)
+    status[i] = -1;
+
+  while (sent < count) {
+    chunk = (count-sent < LIBCAN_MAX_BATCH) ? count-sent : LIBCAN_MAX_BATCH;
+
+    memset(frames, 0, chunk*sizeof(struct can_frame));
+    memset(headers, 0, chunk*sizeof(struct mmsghdr));
+    for (i = 0; i < chunk; ++i) {
+      frames[i].can_id = messages[sent+i].id;
+      frames[i].can_dlc = messages[sent+i].length;
+      memcpy(frames[i].data, messages[sent+i].msg, frames[i].can_dlc);
+      iov[i].iov_base = &frames[i];
+      iov[i].iov_len = sizeof(struct can_frame);
+      headers[i].msg_hdr.msg_iov = &iov[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if ((n = sendmmsg(bus->fd, headers, chunk, 0)) > 0) {
+      for (i = 0; i < n; ++i)
+        status[sent+i] = 0;
+      sent += n;
+      continue;
+    }
+
+    if ((errno != ENOBUFS) && (errno != EAGAIN) && (errno != EINTR))
+      break;
+    /* POLLOUT may be signaled although the device queue is still full */
+    if ((timeout-- <= 0) || (poll(&pfd, 1, 1) < 0)) {
+      ++bus->stats.tx_timeouts;
+      break;
+    }
+  }
+
+  return sent;
+}
+
+/*!
+ *
+ * \brief converts a SocketCAN frame and passes it to the message handlers
+ *
+ */
+static void can_socket_dispatch(CAN_BUS *bus, const struct can_frame *frame,
+  const struct timespec *stamp)
+{
+  CPC_MSG_T cpcmsg;
+
+  memset(&cpcmsg, 0, sizeof(cpcmsg));
+  if (frame->can_id & CAN_EFF_FLAG)
+    cpcmsg.type = (frame->can_id & CAN_RTR_FLAG) ? CPC_MSG_T_XRTR :
+      CPC_MSG_T_XCAN;
+  else
+    cpcmsg.type = (frame->can_id & CAN_RTR_FLAG) ? CPC_MSG_T_RTR :
+      CPC_MSG_T_CAN;
+  cpcmsg.length = sizeof(CPC_CAN_MSG_T);
+
+  can_stamp_message(&cpcmsg, stamp->tv_sec, stamp->tv_nsec);
+
+  cpcmsg.msg.canmsg.id = frame->can_id & CAN_EFF_MASK;
+  cpcmsg.msg.canmsg.length = frame->can_dlc;
+  memcpy(cpcmsg.msg.canmsg.msg, frame->data, frame->can_dlc);
+
+  canBusReceive(bus, &cpcmsg);
+}
+
+/*!
+ *
+ * \brief receives a CAN frame together with its kernel receive timestamp
+ *
+ * \param stamp Receives the timestamp, zero if the kernel provides none
+ * \return 0 on success, -1 on failure
+ *
+ */
+static int can_socket_recv(CAN_BUS *bus, struct can_frame *frame,
+  struct timespec *stamp, int flags)
+{
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+  struct iovec iov;
+  struct msghdr header;
+  struct cmsghdr *cmsg;
+
+  iov.iov_base = frame;
+  iov.iov_len = sizeof(struct can_frame);
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+
+  if (recvmsg(bus->fd, &header, flags) != sizeof(struct can_frame))
+    return -1;
+
+  memset(stamp, 0, sizeof(struct timespec));
+  for (cmsg = CMSG_FIRSTHDR(&header); cmsg;
+      cmsg = CMSG_NXTHDR(&header, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) &&
+        (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+      memcpy(stamp, CMSG_DATA(cmsg), sizeof(struct timespec));
+
+  return 0;
+}
+
+/*!
+ *
+ * \brief reads CAN messages from a SocketCAN socket
+ *
+ * Blocks until a message arrives or LIBCAN_READ_TIMEOUT expires, then
+ * hands all messages queued on the socket to the message handlers.
+ *
+ */
+static EBOOL can_socket_read(CAN_BUS *bus)
+{
+  struct can_frame frame;
+  struct timespec stamp;
+
+  if (can_socket_recv(bus, &frame, &stamp, 0)) {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      ++bus->stats.rx_errors;
+      perror(bus->device);
+    }
+    return EFALSE;
+  }
+
+  do {
+    can_socket_dispatch(bus, &frame, &stamp);
+  }
+  while (!can_socket_recv(bus, &frame, &stamp, MSG_DONTWAIT));
+
+  return ETRUE;
+}
+
+double canGetTime(void)
+{
+  struct timespec time;
+
+  if (can_clock)
+    return can_clock(can_clock_data);
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec+time.tv_nsec*1e-9;
+}
+
+void canSetClock(CAN_CLOCK clock, void *data)
+{
+  can_clock_data = data;
+  can_clock = clock;
+}
+
+double canGetTimestamp(const CPC_MSG_T *cpcmsg)
+{
+  return cpcmsg->ts_sec+cpcmsg->ts_nsec*1e-9;
+}
+
+CAN_BUS *canGetBus(int busId)
+{
+  if ((busId < 0) || (busId >= LIBCAN_MAX_CAN))
+    return 0;
+
+  can_busses[busId].busId = busId;
+  return &can_busses[busId];
+}
+
+int canBusSend(CAN_BUS *bus, int can_id, int length, const char *msg)
+{
+  int result;
+
+  if (!bus->active)
+    return -1;
+  if (!can_valid_length(length)) {
+    ++bus->stats.tx_errors;
+    return -1;
+  }
+
+  pthread_mutex_lock(&bus->tx_mutex);
+  if (bus->comType == SMART_CAN_COM_SOCKET)
+    result = can_socket_send(bus, can_id, length, msg);
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    result = canVirtualSend(bus, can_id, length, msg);
+  else
+    result = can_cpc_send(bus, can_id, length, msg);
+
+  if (result)
+    ++bus->stats.tx_errors;
+  else
+    ++bus->stats.tx_frames;
+  pthread_mutex_unlock(&bus->tx_mutex);
+
+  if (!result)
+    canTraceRecord(bus->busId, CAN_TRACE_TX, canGetTime(), can_id, length,
+      (const unsigned char*)msg);
+
+  return result;
+}
+
+int canBusSendBatch(CAN_BUS *bus, const CPC_CAN_MSG_T *messages, int count,
+  int *status)
+{
+  double start;
+  int i, sent;
+
+  if (!bus->active || (count <= 0))
+    return 0;
+
+  for (i = 0; i < count; ++i)
+    if (!can_valid_length(messages[i].length)) {
+      for (i = 0; i < count; ++i)
+        status[i] = -1;
+      bus->stats.tx_errors += count;
+      return 0;
+    }
+
+  if (bus->writer_running) {
+    for (i = 0, sent = 0; i < count; ++i)
+      if (!(status[i] = canBusQueue(bus, messages[i].id, messages[i].length,
+          (const char*)messages[i].msg, 0.0)))
+        ++sent;
+    return sent;
+  }
+
+  pthread_mutex_lock(&bus->tx_mutex);
+  start = canGetTime();
+  if (bus->comType == SMART_CAN_COM_SOCKET)
+    sent = can_socket_send_batch(bus, messages, count, status);
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    for (i = 0, sent = 0; i < count; ++i) {
+      if (!(status[i] = canVirtualSend(bus, messages[i].id,
+          messages[i].length, (const char*)messages[i].msg)))
+        ++sent;
+    }
+  else
+    sent = can_cpc_send_batch(bus, messages, count, status);
+
+  ++bus->stats.tx_batches;
+  bus->stats.tx_batch_frames += sent;
+  bus->stats.tx_batch_time += canGetTime()-start;
+  bus->stats.tx_frames += sent;
+  bus->stats.tx_errors += count-sent;
+  pthread_mutex_unlock(&bus->tx_mutex);
+
+  if (canTraceActive())
+    for (i = 0; i < count; ++i)
+      if (!status[i])
+        canTraceRecord(bus->busId, CAN_TRACE_TX, start, messages[i].id,
+          messages[i].length, messages[i].msg);
+
+  return sent;
+}
+
+int canHWSendBatch(int busId, const CPC_CAN_MSG_T *messages, int count,
+  int *status)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusSendBatch(bus, messages, count, status) : 0;
+}
+
+/*!
+ *
+ * \brief sends a standard CAN message
+ *
+ * \param busId CAN bus to send the message on
+ * \param can_id Identifier of the CAN message
+ * \param *msg Pointer to the 8byte content of the CAN message
+ *
+ */
+
+int my_send_can_message(int busId, int can_id, char *msg) {
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusQueue(bus, can_id, 8, msg, 0.0) : -1;
+}
+
+/*!
+ *
+ * \brief sends a variable length CAN message
+ *
+ * \param busId CAN bus to send the message on
+ * \param can_id Identifier of the CAN message
+ * \param length Length of the CAN message
+ * \param *msg Pointer to the content of the CAN message
+ *
+ *
+ */
+void my_send_can_message_var_length(int busId, int can_id, int length, char *msg)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (bus)
+    canBusQueue(bus, can_id, length, msg, 0.0);
+}
+
+/*!
+ *
+ * \brief reads a message from a bus regardless of its reader thread
+ *
+ */
+static EBOOL can_bus_read(CAN_BUS *bus)
+{
+  if (!bus->active)
+    return EFALSE;
+  else if (bus->comType == SMART_CAN_COM_SOCKET)
+    return can_socket_read(bus);
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    return canVirtualRead(bus);
+  else
+    return can_cpc_read(bus);
+}
+
+/*!
+ *
+ * \brief reader thread filling the RX ring of a bus
+ *
+ */
+static void* can_bus_reader(void *arg)
+{
+  CAN_BUS *bus = arg;
+
+  while (bus->reader_running)
+    can_bus_read(bus);
+
+  return 0;
+}
+
+EBOOL canBusRead(CAN_BUS *bus)
+{
+  /* The reader thread is the only producer of the RX ring */
+  if (bus->reader_running)
+    return EFALSE;
+
+  return can_bus_read(bus);
+}
+
+/*!
+ *
+ * \brief reads a CAN message
+ *
+ * This function is waiting for a CAN message in the given bus. If a message arrives all registered message handlers
+ * are called one after the other. If no message is available after LIBCAN_READ_TIMEOUT, the function returns
+ * without calling any message handler.
+ *
+ * \param busId CAN bus to read from
+ *
+ *
+ */
+EBOOL read_can_message(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusRead(bus) : EFALSE;
+}
+
+EBOOL canBusProcess(CAN_BUS *bus)
+{
+  struct can_frame frame;
+  struct timespec stamp;
+  EBOOL result = EFALSE;
+
+  if (!bus->active || bus->reader_running)
+    return EFALSE;
+  else if (bus->comType == SMART_CAN_COM_SOCKET) {
+    while (!can_socket_recv(bus, &frame, &stamp, MSG_DONTWAIT)) {
+      can_socket_dispatch(bus, &frame, &stamp);
+      result = ETRUE;
+    }
+  }
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    result = canVirtualProcess(bus);
+  else
+    while (CPC_Handle(bus->handle))
+      result = ETRUE;
+
+  return result;
+}
+
+/*!
+ *
+ * \brief handles all pending CAN messages without waiting
+ *
+ * \param busId CAN bus to read from
+ *
+ */
+EBOOL canHWProcess(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusProcess(bus) : EFALSE;
+}
+
+int canAddIdHandler(int busId, int can_id, CAN_MSG_HANDLER handler)
+{
+  CAN_BUS *bus = canGetBus(busId);
+  CAN_MSG_HANDLER *handlers;
+  int i;
+
+  if (!bus || (can_id < 0) || (can_id >= LIBCAN_NUM_IDS) || !handler)
+    return -1;
+
+  handlers = bus->id_handlers[can_id];
+  for (i = 0; (i < LIBCAN_MAX_ID_HANDLERS) && handlers[i] &&
+    (handlers[i] != handler); ++i);
+  if (i == LIBCAN_MAX_ID_HANDLERS) {
+    EDBG("ERROR: too many handlers for CAN ID 0x%x\n", can_id);
+    return -1;
+  }
+  handlers[i] = handler;
+
+  return 0;
+}
+
+int canRemoveIdHandler(int busId, int can_id, CAN_MSG_HANDLER handler)
+{
+  CAN_BUS *bus = canGetBus(busId);
+  CAN_MSG_HANDLER *handlers;
+  int i;
+
+  if (!bus || (can_id < 0) || (can_id >= LIBCAN_NUM_IDS))
+    return -1;
+
+  handlers = bus->id_handlers[can_id];
+  for (i = 0; (i < LIBCAN_MAX_ID_HANDLERS) && (handlers[i] != handler); ++i);
+  if (i == LIBCAN_MAX_ID_HANDLERS)
+    return -1;
+
+  /* Keep the handlers packed, the dispatcher stops at the first gap */
+  for (; (i < LIBCAN_MAX_ID_HANDLERS-1) && handlers[i+1]; ++i)
+    handlers[i] = handlers[i+1];
+  handlers[i] = 0;
+
+  return 0;
+}
+
+void canSetDefaultHandler(int busId, CAN_MSG_HANDLER handler)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (bus)
+    bus->default_handler = handler;
+}
+
+void canBusDispatch(CAN_BUS *bus, const CPC_MSG_T *cpcmsg)
+{
+  unsigned long can_id = cpcmsg->msg.canmsg.id;
+  CAN_MSG_HANDLER *handlers;
+  int i;
+
+  ++bus->stats.rx_frames;
+
+  if ((cpcmsg->type == CPC_MSG_T_CAN) && (can_id < LIBCAN_NUM_IDS)) {
+    ++bus->id_hits[can_id];
+
+    handlers = bus->id_handlers[can_id];
+    if (handlers[0]) {
+      for (i = 0; (i < LIBCAN_MAX_ID_HANDLERS) && handlers[i]; ++i)
+        handlers[i](bus->busId, cpcmsg);
+      return;
+    }
+  }
+
+  if (bus->default_handler)
+    bus->default_handler(bus->busId, cpcmsg);
+  else
+    ++bus->stats.rx_unhandled;
+}
+
+int canBusStartReader(CAN_BUS *bus, unsigned int size)
+{
+  CAN_RX_RING *ring = &bus->rx_ring;
+
+  if (!bus->active || bus->reader_running || !size)
+    return -1;
+
+  pthread_mutex_lock(&ring->mutex);
+  for (ring->size = 1; ring->size < size; ring->size <<= 1);
+  if (!(ring->messages = calloc(ring->size, sizeof(CPC_MSG_T)))) {
+    pthread_mutex_unlock(&ring->mutex);
+    return -1;
+  }
+  ring->head = 0;
+  ring->tail = 0;
+  ring->max_fill = 0;
+
+  bus->reader_running = ETRUE;
+  if (pthread_create(&bus->reader, 0, can_bus_reader, bus)) {
+    bus->reader_running = EFALSE;
+    free(ring->messages);
+    ring->messages = 0;
+    pthread_mutex_unlock(&ring->mutex);
+    return -1;
+  }
+  pthread_mutex_unlock(&ring->mutex);
+
+  return 0;
+}
+
+int canBusStopReader(CAN_BUS *bus)
+{
+  if (!bus->reader_running)
+    return -1;
+
+  /* The reader notices within LIBCAN_READ_TIMEOUT */
+  bus->reader_running = EFALSE;
+  pthread_join(bus->reader, 0);
+
+  /* A concurrent drain finishes before the messages are released */
+  pthread_mutex_lock(&bus->rx_ring.mutex);
+  free(bus->rx_ring.messages);
+  bus->rx_ring.messages = 0;
+  pthread_mutex_unlock(&bus->rx_ring.mutex);
+
+  return 0;
+}
+
+int canBusDrain(CAN_BUS *bus, int max_messages)
+{
+  CAN_RX_RING *ring = &bus->rx_ring;
+  unsigned int head, tail;
+  int n = 0;
+
+  pthread_mutex_lock(&ring->mutex);
+  if (!ring->messages) {
+    pthread_mutex_unlock(&ring->mutex);
+    return 0;
+  }
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  for (tail = ring->tail; (tail != head) &&
+      ((max_messages <= 0) || (n < max_messages)); ++tail, ++n)
+    canBusDispatch(bus, &ring->messages[tail & (ring->size-1)]);
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&ring->mutex);
+
+  return n;
+}
+
+int canBusStartWriter(CAN_BUS *bus, unsigned int size, double max_age)
+{
+  CAN_TX_QUEUE *queue = &bus->tx_queue;
+
+  if (!bus->active || bus->writer_running || !size)
+    return -1;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (!(queue->entries = calloc(size, sizeof(CAN_TX_ENTRY)))) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  queue->size = size;
+  queue->count = 0;
+  queue->sequence = 0;
+  queue->max_age = max_age;
+
+  bus->writer_running = ETRUE;
+  if (pthread_create(&bus->writer, 0, can_bus_writer, bus)) {
+    bus->writer_running = EFALSE;
+    free(queue->entries);
+    queue->entries = 0;
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
+}
+
+int canBusStopWriter(CAN_BUS *bus)
+{
+  CAN_TX_QUEUE *queue = &bus->tx_queue;
+
+  CAN_TX_ENTRY entry;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (!bus->writer_running) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  bus->writer_running = EFALSE;
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  pthread_join(bus->writer, 0);
+
+  /* Messages queued meanwhile are sent directly, the remaining ones are
+     flushed in the writer's order, e.g. a final neutral actuator command */
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count) {
+    entry = queue->entries[0];
+    can_tx_remove(queue, 0);
+    if (entry.deadline && (canGetTime() > entry.deadline))
+      ++bus->stats.tx_stale;
+    else
+      canBusSend(bus, entry.message.id, entry.message.length,
+        (const char*)entry.message.msg);
+  }
+  free(queue->entries);
+  queue->entries = 0;
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
+}
+
+int canBusQueue(CAN_BUS *bus, int can_id, int length, const char *msg,
+  double max_age)
+{
+  CAN_TX_QUEUE *queue = &bus->tx_queue;
+  CAN_TX_ENTRY entry;
+  unsigned int i, last;
+
+  if (!can_valid_length(length)) {
+    ++bus->stats.tx_errors;
+    return -1;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.message.id = can_id;
+  entry.message.length = length;
+  memcpy(entry.message.msg, msg, length);
+  if (max_age <= 0.0)
+    max_age = queue->max_age;
+  entry.deadline = (max_age > 0.0) ? canGetTime()+max_age : 0.0;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (!bus->writer_running) {
+    pthread_mutex_unlock(&queue->mutex);
+    return canBusSend(bus, can_id, length, msg);
+  }
+  entry.sequence = queue->sequence++;
+
+  if (queue->count == queue->size) {
+    /* The least urgent message is one of the leaves of the heap, it gets
+       replaced if the new message is more urgent */
+    for (i = last = queue->count/2; i < queue->count; ++i)
+      if (can_tx_before(&queue->entries[last], &queue->entries[i]))
+        last = i;
+    ++bus->stats.tx_overruns;
+    if (!can_tx_before(&entry, &queue->entries[last])) {
+      pthread_mutex_unlock(&queue->mutex);
+      return -1;
+    }
+    can_tx_remove(queue, last);
+  }
+
+  queue->entries[queue->count++] = entry;
+  can_tx_sift(queue, queue->count-1);
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
+}
+
+int canHWStartWriter(int busId, unsigned int size, double max_age)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusStartWriter(bus, size, max_age) : -1;
+}
+
+int canHWStopWriter(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusStopWriter(bus) : -1;
+}
+
+int canHWQueue(int busId, int can_id, int length, char *msg, double max_age)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusQueue(bus, can_id, length, msg, max_age) : -1;
+}
+
+int canHWStartReader(int busId, unsigned int size)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusStartReader(bus, size) : -1;
+}
+
+int canHWStopReader(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusStopReader(bus) : -1;
+}
+
+int canHWDrain(int busId, int max_messages)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusDrain(bus, max_messages) : 0;
+}
+
+void canDispatch(int busId, const CPC_MSG_T *cpcmsg)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (bus)
+    canBusDispatch(bus, cpcmsg);
+}
+
+unsigned long canGetIdHits(int busId, int can_id)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (!bus || (can_id < 0) || (can_id >= LIBCAN_NUM_IDS))
+    return 0;
+
+  return bus->id_hits[can_id];
+}
+
+void canResetIdHits(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (bus)
+    memset(bus->id_hits, 0, sizeof(bus->id_hits));
+}
+
+void canComputeAcceptanceFilter(const int *can_ids, int num_ids,
+  CAN_ACCEPTANCE_FILTER *filter)
+{
+  int code[2], mask[2], accepted, best_accepted = -1;
+  int i;
+
+  if (num_ids <= 0) {
+    memset(filter->code, 0xff, sizeof(filter->code));
+    memset(filter->mask, 0xff, sizeof(filter->mask));
+    return;
+  }
+
+  /* Each identifier is assigned to one of the two filters such that the
+     number of identifiers accepted in total becomes minimal. Large sets are
+     split in ascending order of the identifiers only. */
+  if (num_ids <= LIBCAN_FILTER_EXHAUSTIVE_IDS) {
+    unsigned int group, best_group = 0, all = (1U << num_ids)-1;
+
+    for (group = 1; group < (1U << (num_ids-1)); ++group) {
+      accepted = can_filter_group(can_ids, num_ids, group, &code[0],
+          &mask[0])+
+        can_filter_group(can_ids, num_ids, all & ~group, &code[1], &mask[1]);
+      if ((best_accepted < 0) || (accepted < best_accepted)) {
+        best_accepted = accepted;
+        best_group = group;
+      }
+    }
+
+    /* A single identifier is accepted by both filters */
+    can_filter_group(can_ids, num_ids, best_group ? best_group : all,
+      &code[0], &mask[0]);
+    can_filter_group(can_ids, num_ids, all & ~best_group, &code[1],
+      &mask[1]);
+  }
+  else {
+    int sorted[LIBCAN_MAX_FILTER_IDS], best_split = 1, j, tmp;
+
+    memcpy(sorted, can_ids, num_ids*sizeof(int));
+    for (i = 1; i < num_ids; ++i)
+      for (j = i; (j > 0) && (sorted[j-1] > sorted[j]); --j) {
+        tmp = sorted[j];
+        sorted[j] = sorted[j-1];
+        sorted[j-1] = tmp;
+      }
+
+    for (i = 1; i < num_ids; ++i) {
+      accepted = can_filter_range(sorted, 0, i, &code[0], &mask[0])+
+        can_filter_range(sorted, i, num_ids, &code[1], &mask[1]);
+      if ((best_accepted < 0) || (accepted < best_accepted)) {
+        best_accepted = accepted;
+        best_split = i;
+      }
+    }
+
+    can_filter_range(sorted, 0, best_split, &code[0], &mask[0]);
+    can_filter_range(sorted, best_split, num_ids, &code[1], &mask[1]);
+  }
+
+  /* The data byte nibbles of filter 1 are ignored, only the RTR bit is
+     compared besides the identifier, such that both filters reject remote
+     frames */
+  filter->code[0] = code[0] >> 3;
+  filter->code[1] = (code[0] & 0x07) << 5;
+  filter->code[2] = code[1] >> 3;
+  filter->code[3] = (code[1] & 0x07) << 5;
+  filter->mask[0] = mask[0] >> 3;
+  filter->mask[1] = ((mask[0] & 0x07) << 5) | 0x0f;
+  filter->mask[2] = mask[1] >> 3;
+  filter->mask[3] = ((mask[1] & 0x07) << 5) | 0x0f;
+}
+
+int canHWSetFilter(int busId, const int *can_ids, int num_ids)
+{
+  CAN_BUS *bus = canGetBus(busId);
+  int i;
+
+  if (!bus || (num_ids > LIBCAN_MAX_FILTER_IDS))
+    return -1;
+  for (i = 0; i < num_ids; ++i)
+    if ((can_ids[i] < 0) || (can_ids[i] >= LIBCAN_NUM_IDS))
+      return -1;
+
+  bus->filter_set = (num_ids > 0);
+  memcpy(bus->filter_ids, can_ids, num_ids*sizeof(int));
+  bus->num_filter_ids = num_ids;
+  canComputeAcceptanceFilter(can_ids, num_ids, &bus->acc_filter);
+
+  EDBG("acceptance filter of bus %d: code %02x %02x %02x %02x, "
+    "mask %02x %02x %02x %02x\n", busId,
+    bus->acc_filter.code[0], bus->acc_filter.code[1],
+    bus->acc_filter.code[2], bus->acc_filter.code[3],
+    bus->acc_filter.mask[0], bus->acc_filter.mask[1],
+    bus->acc_filter.mask[2], bus->acc_filter.mask[3]);
+
+  /* Filters set before initialization get applied by canHWInit() */
+  if (!bus->active)
+    return 0;
+  else if (bus->comType == SMART_CAN_COM_SOCKET)
+    return can_socket_set_filter(bus);
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    return 0;
+  else
+    return can_cpc_init_controller(bus);
+}
+
+int canHWSetFilterFromHandlers(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+  int can_ids[LIBCAN_MAX_FILTER_IDS];
+  int can_id, num_ids = 0;
+
+  if (!bus)
+    return -1;
+
+  /* The catch-all handler is interested in all messages */
+  if (bus->default_handler)
+    return canHWSetFilter(busId, 0, 0);
+
+  for (can_id = 0; can_id < LIBCAN_NUM_IDS; ++can_id)
+    if (bus->id_handlers[can_id][0]) {
+      if (num_ids == LIBCAN_MAX_FILTER_IDS)
+        return canHWSetFilter(busId, 0, 0);
+      can_ids[num_ids++] = can_id;
+    }
+
+  return canHWSetFilter(busId, can_ids, num_ids);
+}
+
+int canHWGetFd(int busId)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return (bus && bus->active) ? bus->fd : -1;
+}
+
+int canBusCleanup(CAN_BUS *bus)
+{
+  if (!bus->active)
+    return -1;
+
+  canBusStopReader(bus);
+  canBusStopWriter(bus);
+  bus->active = EFALSE;
+  can_active[bus->busId] = 0;
+  pthread_mutex_destroy(&bus->tx_mutex);
+
+  if (bus->comType == SMART_CAN_COM_SOCKET)
+    return close(bus->fd);
+  else if (bus->comType == SMART_CAN_COM_VIRTUAL)
+    return canVirtualClose(bus);
+  else
+    return CPC_CloseChannel(bus->handle);
+}
+
+int canHWCleanup(int busId){
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusCleanup(bus) : -1;
+}
+
+
+/*!
+ *
+ * \brief Init CAN bus access
+ *
+ * Initializes a given CAN bus.
+ *
+ * \param busId CAN bus Number
+ * \param bitrate Bitrate for the communication in Kbaud (supprted bitrates are 100, 250, 500 and 1000)
+ * \param *can_device Device to connect to (eg: /dev/usb/cpc_usb0)
+ *
+ */
+int canHWInit(int busId, int bitrate, char *can_device)
+{
+  return canHWInitComType(busId, SMART_CAN_COM_USB, bitrate, can_device);
+}
+
+/*!
+ *
+ * \brief Init CAN bus access through a given communication type
+ *
+ * \param busId CAN bus Number
+ * \param comType Communication type used to access the bus
+ * \param bitrate Bitrate for the communication in Kbaud (supprted bitrates are 100, 250, 500 and 1000)
+ * \param *can_device Device or network interface to connect to
+ *
+ */
+int canHWInitComType(int busId, SMART_CAN_COM_TYPE comType, int bitrate,
+  char *can_device)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  return bus ? canBusInit(bus, comType, bitrate, can_device) : -1;
+}
+
+int canBusInit(CAN_BUS *bus, SMART_CAN_COM_TYPE comType, int bitrate,
+  char *can_device)
+{
+  int reply;
+
+  //EDBG_DISABLE();
+  EDBG("Starting CANHWInit...");
+  EDBG("configuring port %d with %d baud",bus->busId,bitrate);
+  if (bus->active)
+    canBusCleanup(bus);
+
+  bus->comType = comType;
+  strncpy(bus->device, can_device, sizeof(bus->device)-1);
+  memset(&bus->stats, 0, sizeof(bus->stats));
+  pthread_mutex_init(&bus->tx_mutex, 0);
+
+  if (comType == SMART_CAN_COM_SOCKET) {
+    /* The bitrate of a SocketCAN interface is set through netlink */
+    if ((bus->fd = can_socket_open(bus->device)) < 0) {
+      pthread_mutex_destroy(&bus->tx_mutex);
+      return -1;
+    }
+    bus->handle = bus->fd;
+    EDBG("%s is SocketCAN interface -> socket %d\n", bus->device, bus->fd);
+    register_msg_handlers(bus->busId);
+    if (can_socket_set_filter(bus))
+      perror(bus->device);
+
+    EDBG("InitHW finished...\n");
+    bus->active = ETRUE;
+    can_active[bus->busId]=1;
+
+    return 0;
+  }
+
+  if (comType == SMART_CAN_COM_VIRTUAL) {
+    /* Busses sharing the device string are connected in memory */
+    if ((bus->fd = canVirtualOpen(bus, bitrate)) < 0) {
+      pthread_mutex_destroy(&bus->tx_mutex);
+      return -1;
+    }
+    bus->handle = bus->fd;
+    EDBG("%s is virtual CAN network -> descriptor %d\n", bus->device,
+      bus->fd);
+    register_msg_handlers(bus->busId);
+
+    EDBG("InitHW finished...\n");
+    bus->active = ETRUE;
+    can_active[bus->busId]=1;
+
+    return 0;
+  }
+
+  switch (bitrate){
+  case 1000:
+    /* Bitrate 1 Mbit */
+    bus->btr0=0x00;
+    bus->btr1=0x14;
+    break;
+  case 250:
+    /* Bitrate 250 Kbit */
+    bus->btr0=0x01;
+    bus->btr1=0x1c;
+    break;
+  case 500:
+    /* Baudrate 500 used for smart */
+
+    bus->btr0=0x00;
+    bus->btr1=0x1c;
+    break;
+  case 100:
+    bus->btr0=0x04;
+    bus->btr1=0x1c;
+    break;
+  }
+
+  /*Open the CAN*/
+  if((bus->handle = CPC_OpenChannel(bus->device)) < 0)
+    {
+      EDBG("ERROR: %s\n", CPC_DecodeErrorMsg(bus->handle));
+      pthread_mutex_destroy(&bus->tx_mutex);
+      return -1;
+    }
+  EDBG("%s is CAN interface -> handle %d\n", bus->device, bus->handle);
+
+  /* ############################# Init Parameters ######################*/
+
+  /*Define Handlers*/
+  CPC_AddHandler(bus->handle, can_cpc_dispatch);
+  register_msg_handlers(bus->busId);
+
+  reply = can_cpc_init_controller(bus);
+
+  bus->fd = CPC_GetFdByHandle(bus->handle);
+
+  EDBG("cpcfd= %d\n",bus->fd);
   EDBG("InitHW finished...\n");
-  can_active[busId]=1;
+  bus->active = ETRUE;
+  can_active[bus->busId]=1;
 
   return reply;
 }
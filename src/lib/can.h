@@ -1,10 +1,14 @@
 #ifndef SMART_CAN_H
 #define SMART_CAN_H
 
+#include <pthread.h>
+
 #include <libcpc/cpclib.h>
 
 #include <libelrob/Etypes.h>
 
+#include "smart.h"
+
 /*! \defgroup smartlibcan Library for USB CAN access
 * \ingroup smartlibs
 */
@@ -16,8 +20,316 @@
 /*! \brief CAN operation timeout in [s] */
 #define LIBCAN_TIMEOUT 0.05
 
+/*! \brief Timeout of read_can_message() in [s] */
+#define LIBCAN_READ_TIMEOUT 0.5
+
+/*! \brief Number of distinct standard (11 bit) CAN identifiers */
+#define LIBCAN_NUM_IDS 2048
+
+/*! \brief Maximum number of message handlers per CAN identifier */
+#define LIBCAN_MAX_ID_HANDLERS 4
+
+/*! \brief Maximum number of CAN identifiers passing a bus' acceptance filter */
+#define LIBCAN_MAX_FILTER_IDS 64
+
+/*! \brief Maximum number of frames submitted with one system call */
+#define LIBCAN_MAX_BATCH 32
+
+/*! \brief Replacement of the monotonic clock, returning the time in [s] */
+typedef double (*CAN_CLOCK)(void *data);
+
+/*! \brief Acceptance code and mask registers of an SJA1000 CAN controller
+ *
+ * The controller is operated in dual filter mode. A mask bit set to 1
+ * excludes the respective code bit from the comparison.
+ */
+typedef struct CAN_ACCEPTANCE_FILTER {
+  unsigned char code[4]; ///< Acceptance code registers 0 to 3
+  unsigned char mask[4]; ///< Acceptance mask registers 0 to 3
+} CAN_ACCEPTANCE_FILTER;
+
+/*! \brief Message handler called by the dispatcher
+ *
+ * The first argument is the number of the bus the message was received on.
+ */
+typedef void (*CAN_MSG_HANDLER)(int busId, const CPC_MSG_T *cpcmsg);
+
+/*! \brief Statistics of a CAN bus */
+typedef struct CAN_BUS_STATS {
+  unsigned long rx_frames; ///< Messages received
+  unsigned long rx_unhandled; ///< Messages received without a handler
+  unsigned long rx_errors; ///< Failed read operations
+  unsigned long rx_overruns; ///< Messages dropped due to a full RX ring
+  unsigned long tx_frames; ///< Messages sent
+  unsigned long tx_errors; ///< Messages which could not be sent
+  unsigned long tx_timeouts; ///< Messages dropped due to a busy device
+  unsigned long tx_stale; ///< Queued messages dropped after their deadline
+  unsigned long tx_overruns; ///< Messages dropped due to a full TX queue
+  unsigned long tx_batches; ///< Number of batch transmissions
+  unsigned long tx_batch_frames; ///< Messages sent in batches
+  double tx_batch_time; ///< Time spent sending batches in [s]
+} CAN_BUS_STATS;
+
+/*! \brief Single-producer/single-consumer ring of received messages
+ *
+ * The ring decouples the thread reading a bus from the thread handling its
+ * messages. The reader only advances the head, the consumer only the tail.
+ * Messages arriving while the ring is full are dropped and counted.
+ */
+typedef struct CAN_RX_RING {
+  CPC_MSG_T *messages; ///< Preallocated messages including timestamps
+  unsigned int size; ///< Number of messages, a power of two
+  unsigned int head __attribute__((aligned(64))); ///< Next message written
+  unsigned int tail __attribute__((aligned(64))); ///< Next message read
+  unsigned int max_fill; ///< Maximum number of messages queued at once
+  pthread_mutex_t mutex; ///< Keeps the messages alive while being drained
+} CAN_RX_RING;
+
+/*! \brief Message queued for transmission */
+typedef struct CAN_TX_ENTRY {
+  CPC_CAN_MSG_T message; ///< The message
+  unsigned long sequence; ///< Position in the order of queueing
+  double deadline; ///< Monotonic time after which the message is dropped
+} CAN_TX_ENTRY;
+
+/*! \brief Priority queue of messages to be sent by the writer thread
+ *
+ * The queue is a binary heap ordered by CAN identifier, such that the
+ * message which would win the bus arbitration is sent first.
+ */
+typedef struct CAN_TX_QUEUE {
+  CAN_TX_ENTRY *entries; ///< Preallocated heap entries
+  unsigned int size; ///< Capacity of the queue
+  unsigned int count; ///< Number of queued messages
+  unsigned long sequence; ///< Sequence number of the next message
+  double max_age; ///< Default lifetime of queued messages in [s]
+  pthread_mutex_t mutex; ///< Protects the queue
+  pthread_cond_t cond; ///< Signals queued messages to the writer thread
+} CAN_TX_QUEUE;
+
+/*! \brief Context of a CAN bus
+ *
+ * All state of a bus is kept in its context, such that different busses
+ * may be served from different threads concurrently. Messages of one bus
+ * may be sent from several threads, whereas reading a bus is reserved to
+ * one thread at a time.
+ */
+typedef struct CAN_BUS {
+  int busId; ///< CAN bus Number
+  SMART_CAN_COM_TYPE comType; ///< Communication type used to access the bus
+  char device[32]; ///< Device or network interface of the bus
+  EBOOL active; ///< The bus has been initialized
+  int handle; ///< CPC channel handle or SocketCAN socket
+  int fd; ///< Descriptor which becomes readable when messages arrive
+  unsigned char btr0; ///< SJA1000 bus timing register 0
+  unsigned char btr1; ///< SJA1000 bus timing register 1
+  pthread_mutex_t tx_mutex; ///< Serializes transmissions on the bus
+
+  CAN_MSG_HANDLER id_handlers[LIBCAN_NUM_IDS][LIBCAN_MAX_ID_HANDLERS];
+    ///< Message handlers indexed by the standard CAN identifier
+  CAN_MSG_HANDLER default_handler; ///< The catch-all message handler
+  unsigned long id_hits[LIBCAN_NUM_IDS]; ///< Messages per CAN identifier
+
+  EBOOL filter_set; ///< The bus accepts the filter identifiers only
+  int filter_ids[LIBCAN_MAX_FILTER_IDS]; ///< Identifiers passing the filter
+  int num_filter_ids; ///< Number of identifiers passing the filter
+  CAN_ACCEPTANCE_FILTER acc_filter; ///< Acceptance filter of the controller
+
+  CAN_RX_RING rx_ring; ///< RX ring filled by the reader thread
+  pthread_t reader; ///< The reader thread
+  volatile EBOOL reader_running; ///< The reader thread fills the RX ring
+  volatile EBOOL reactor_attached; ///< A reactor processes the bus
+
+  CAN_TX_QUEUE tx_queue; ///< TX queue drained by the writer thread
+  pthread_t writer; ///< The writer thread
+  volatile EBOOL writer_running; ///< Messages are sent through the queue
+
+  CAN_BUS_STATS stats; ///< Statistics of the bus
+} CAN_BUS;
+
 /*! \brief Recording wich busses are allready initialized */
-int can_active[LIBCAN_MAX_CAN];
+extern int can_active[LIBCAN_MAX_CAN];
+
+/*!
+ *
+ * \brief current time of the monotonic clock
+ *
+ * \return The time in [s]
+ *
+ */
+double canGetTime(void);
+
+/*!
+ *
+ * \brief replace the clock returned by canGetTime()
+ *
+ * This allows for running simulations faster than real time. Receive
+ * timestamps of hardware busses are not affected.
+ *
+ * \param clock The clock, 0 to restore the monotonic clock
+ * \param data User data passed to the clock
+ *
+ */
+void canSetClock(CAN_CLOCK clock, void *data);
+
+/*!
+ *
+ * \brief receive timestamp of a CAN message
+ *
+ * Messages passed to the message handlers carry their receive timestamps
+ * in the monotonic clock domain, as returned by canGetTime(). The stamps
+ * are taken by the CPC driver or the SocketCAN kernel on reception, not
+ * when the message is processed.
+ *
+ * \return The timestamp in [s]
+ *
+ */
+double canGetTimestamp(const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief Context of a CAN bus
+ *
+ * \param busId CAN bus Number
+ * \return The context of the bus or 0 if the bus number is invalid
+ *
+ */
+CAN_BUS *canGetBus(int busId);
+
+/*!
+ *
+ * \brief Init CAN bus access through a bus context
+ *
+ * \see canHWInitComType()
+ *
+ */
+int canBusInit(CAN_BUS *bus, SMART_CAN_COM_TYPE comType, int bitrate,
+  char *device);
+
+/*!
+ *
+ * \brief Close CAN bus access through a bus context
+ *
+ */
+int canBusCleanup(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief sends a CAN message through a bus context
+ *
+ * Waits for at most LIBCAN_TIMEOUT for the device to accept the message.
+ *
+ * \param can_id Identifier of the CAN message
+ * \param length Length of the CAN message
+ * \param *msg Pointer to the content of the CAN message
+ * \return 0 on success, a negative value on failure or timeout
+ *
+ */
+int canBusSend(CAN_BUS *bus, int can_id, int length, const char *msg);
+
+/*!
+ *
+ * \brief reads CAN messages through a bus context
+ *
+ * \see read_can_message()
+ *
+ */
+EBOOL canBusRead(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief handles all pending CAN messages through a bus context
+ *
+ * \see canHWProcess()
+ *
+ */
+EBOOL canBusProcess(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief pass a received message on to the RX ring or to the handlers
+ *
+ * This function is called by the bus backends for every message received.
+ * While a reader thread is running, it is the ring's single producer, since
+ * canBusRead() and canBusProcess() refuse to read the bus from other
+ * threads. Messages which do not fit into the ring are dropped.
+ *
+ */
+void canBusReceive(CAN_BUS *bus, const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief pass a message to the handlers registered with a bus context
+ *
+ * \see canDispatch()
+ *
+ */
+void canBusDispatch(CAN_BUS *bus, const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief start a reader thread filling the RX ring of a bus context
+ *
+ * \see canHWStartReader()
+ *
+ */
+int canBusStartReader(CAN_BUS *bus, unsigned int size);
+
+/*!
+ *
+ * \brief stop the reader thread of a bus context
+ *
+ * \see canHWStopReader()
+ *
+ */
+int canBusStopReader(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief handle messages queued in the RX ring of a bus context
+ *
+ * \see canHWDrain()
+ *
+ */
+int canBusDrain(CAN_BUS *bus, int max_messages);
+
+/*!
+ *
+ * \brief send an array of CAN messages through a bus context
+ *
+ * \see canHWSendBatch()
+ *
+ */
+int canBusSendBatch(CAN_BUS *bus, const CPC_CAN_MSG_T *messages, int count,
+  int *status);
+
+/*!
+ *
+ * \brief start a writer thread draining the TX queue of a bus context
+ *
+ * \see canHWStartWriter()
+ *
+ */
+int canBusStartWriter(CAN_BUS *bus, unsigned int size, double max_age);
+
+/*!
+ *
+ * \brief stop the writer thread of a bus context
+ *
+ * \see canHWStopWriter()
+ *
+ */
+int canBusStopWriter(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief queue a CAN message for transmission through a bus context
+ *
+ * \see canHWQueue()
+ *
+ */
+int canBusQueue(CAN_BUS *bus, int can_id, int length, const char *msg,
+  double max_age);
 
 /*!
  *
@@ -32,6 +344,24 @@ int can_active[LIBCAN_MAX_CAN];
  */
 int canHWInit(int busId,int bitrate, char *device);
 
+/*!
+ *
+ * \brief Init CAN bus access through a given communication type
+ *
+ * Initializes a given CAN bus either through the CPC API (USB and PCI) or
+ * through the kernel's SocketCAN stack. For SocketCAN, the device is the
+ * name of the network interface (eg: can0 or vcan0) whose bitrate must have
+ * been configured beforehand (eg: ip link set can0 type can bitrate 500000).
+ *
+ * \param busId CAN bus Number
+ * \param comType Communication type used to access the bus
+ * \param bitrate Bitrate for the communication in Kbaud (supprted bitrates are 100, 250, 500 and 1000)
+ * \param *device Device or network interface to connect to
+ *
+ */
+int canHWInitComType(int busId, SMART_CAN_COM_TYPE comType, int bitrate,
+  char *device);
+
 int canHWCleanup(int busId);
 
 /*!
@@ -51,15 +381,266 @@ void read_SDO_msg_handler(int handle, const CPC_MSG_T * cpcmsg);
  * \brief reads a CAN message
  *
  * This function is waiting for a CAN message in the given bus. If a message arrives all registered message handlers 
- * are called one after the other. If no message is available after a time defined in SELECT, the function returns 
+ * are called one after the other. If no message is available after LIBCAN_READ_TIMEOUT, the function returns 
  * without calling any message handler.  
- * \todo update comment
  * \param busId CAN bus to read from
  * 
  * 
  */
 EBOOL read_can_message(int busId);
 
+/*!
+ *
+ * \brief handles all pending CAN messages
+ *
+ * Calls the registered message handlers for all messages which have already
+ * been received on the given bus. In contrast to read_can_message(), this
+ * function never waits and is meant to be called once an event loop reports
+ * the bus' file descriptor readable.
+ *
+ * \param busId CAN bus to read from
+ * \return ETRUE if at least one message was handled
+ *
+ */
+EBOOL canHWProcess(int busId);
+
+/*!
+ *
+ * \brief send an array of CAN messages in one operation
+ *
+ * The messages are sent in the given order. On SocketCAN, they are
+ * submitted with sendmmsg() in chunks of LIBCAN_MAX_BATCH frames. On CPC
+ * devices, the channel is waited for once and the messages are passed to
+ * the device back to back. If the writer thread of the bus runs, the
+ * messages are queued instead.
+ *
+ * The bus statistics tx_batches, tx_batch_frames and tx_batch_time yield
+ * the throughput of batch transmissions.
+ *
+ * \param busId CAN bus to send the messages on
+ * \param messages The messages to be sent
+ * \param count Number of messages
+ * \param status Array receiving 0 for each message sent or queued and -1
+ *   for each message failed
+ * \return The number of messages sent or queued, 0 if any message is
+ *   longer than 8 bytes
+ *
+ */
+int canHWSendBatch(int busId, const CPC_CAN_MSG_T *messages, int count,
+  int *status);
+
+/*!
+ *
+ * \brief start a writer thread for a CAN bus
+ *
+ * Once the writer thread runs, my_send_can_message() and
+ * my_send_can_message_var_length() queue their messages and return
+ * immediately. The writer thread sends queued messages in the order of
+ * their CAN identifiers, such that actuator commands never wait behind
+ * configuration traffic with higher identifiers. Messages still queued
+ * after their deadline are dropped. If the queue is full, the least urgent
+ * message is dropped.
+ *
+ * \param busId CAN bus Number
+ * \param size Capacity of the queue
+ * \param max_age Default lifetime of queued messages in [s], 0 for
+ *   unlimited lifetime
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canHWStartWriter(int busId, unsigned int size, double max_age);
+
+/*!
+ *
+ * \brief stop the writer thread of a CAN bus
+ *
+ * Messages still queued are sent directly in the order of the writer
+ * thread, unless their lifetime has expired.
+ *
+ */
+int canHWStopWriter(int busId);
+
+/*!
+ *
+ * \brief queue a CAN message for transmission
+ *
+ * Without a writer thread, the message is sent immediately.
+ *
+ * \param busId CAN bus to send the message on
+ * \param can_id Identifier of the CAN message
+ * \param length Length of the CAN message
+ * \param *msg Pointer to the content of the CAN message
+ * \param max_age Lifetime of the message in [s], 0 for the queue's
+ *   default lifetime
+ * \return 0 if the message was queued or sent, -1 otherwise
+ *
+ */
+int canHWQueue(int busId, int can_id, int length, char *msg, double max_age);
+
+/*!
+ *
+ * \brief start a reader thread for a CAN bus
+ *
+ * The reader thread pushes all messages received on the bus together with
+ * their receive timestamps into a preallocated ring instead of calling the
+ * message handlers. The handlers are then called from the consuming thread
+ * through canHWDrain(), which decouples the bus from the consumer's cycle.
+ * While the reader thread runs, read_can_message() and canHWProcess()
+ * return EFALSE without reading the bus, and the bus must not be attached
+ * to a reactor.
+ *
+ * \param busId CAN bus Number
+ * \param size Capacity of the ring, rounded up to a power of two
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canHWStartReader(int busId, unsigned int size);
+
+/*!
+ *
+ * \brief stop the reader thread of a CAN bus
+ *
+ * Messages still queued in the ring are discarded. The ring is released
+ * once a concurrent canHWDrain() has returned, later calls of canHWDrain()
+ * handle no messages.
+ *
+ */
+int canHWStopReader(int busId);
+
+/*!
+ *
+ * \brief handle messages queued by the reader thread of a CAN bus
+ *
+ * Calls the registered message handlers for the queued messages in the
+ * order of their arrival. Must be called from one thread at a time.
+ *
+ * \param busId CAN bus Number
+ * \param max_messages Maximum number of messages handled, 0 for all
+ * \return The number of handled messages
+ *
+ */
+int canHWDrain(int busId, int max_messages);
+
+/*!
+ *
+ * \brief register a message handler for a CAN identifier
+ *
+ * Received standard data frames are dispatched through a table indexed by
+ * their identifier, such that only the handlers registered for that
+ * identifier get called. The library's own decoders are registered by
+ * canHWInit().
+ *
+ * \param busId CAN bus Number
+ * \param can_id Standard (11 bit) CAN identifier
+ * \param handler The handler, which is registered only once per identifier
+ * \return 0 on success, -1 if the identifier is invalid or has too many
+ *   handlers
+ *
+ */
+int canAddIdHandler(int busId, int can_id, CAN_MSG_HANDLER handler);
+
+/*!
+ *
+ * \brief unregister a message handler for a CAN identifier
+ *
+ */
+int canRemoveIdHandler(int busId, int can_id, CAN_MSG_HANDLER handler);
+
+/*!
+ *
+ * \brief register the catch-all message handler of a bus
+ *
+ * The catch-all handler receives all messages for which no identifier
+ * handler is registered, including extended and remote frames.
+ *
+ * \param busId CAN bus Number
+ * \param handler The handler or 0 to discard such messages
+ *
+ */
+void canSetDefaultHandler(int busId, CAN_MSG_HANDLER handler);
+
+/*!
+ *
+ * \brief pass a message to the handlers registered for its identifier
+ *
+ * \param busId CAN bus the message was received on
+ * \param *cpcmsg The message
+ *
+ */
+void canDispatch(int busId, const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief number of standard data frames received for a CAN identifier
+ *
+ */
+unsigned long canGetIdHits(int busId, int can_id);
+
+/*!
+ *
+ * \brief reset the per identifier message counters of a bus
+ *
+ */
+void canResetIdHits(int busId);
+
+/*!
+ *
+ * \brief derive the SJA1000 acceptance filter for a set of CAN identifiers
+ *
+ * The identifiers are distributed onto the two filters of the controller
+ * such that the number of additionally accepted identifiers is minimal.
+ * An empty set results in a filter accepting all messages.
+ *
+ * \param *can_ids The standard (11 bit) CAN identifiers to be accepted
+ * \param num_ids Number of identifiers
+ * \param *filter The resulting acceptance code and mask
+ *
+ */
+void canComputeAcceptanceFilter(const int *can_ids, int num_ids,
+  CAN_ACCEPTANCE_FILTER *filter);
+
+/*!
+ *
+ * \brief restrict the messages received on a CAN bus
+ *
+ * On CPC devices, the acceptance filter derived from the identifiers is
+ * written to the CAN controller, which is re-initialized if the bus is
+ * already active. SocketCAN busses additionally install an exact per
+ * identifier filter in the kernel. Filters may be set before canHWInit().
+ *
+ * \param busId CAN bus Number
+ * \param *can_ids The standard (11 bit) CAN identifiers to be accepted
+ * \param num_ids Number of identifiers, 0 to accept all messages
+ * \return 0 on success, a negative value on failure
+ *
+ */
+int canHWSetFilter(int busId, const int *can_ids, int num_ids);
+
+/*!
+ *
+ * \brief restrict the messages received on a CAN bus to the handled ones
+ *
+ * Sets the filter of the bus to the identifiers for which message handlers
+ * are registered. All messages are accepted if a catch-all handler is
+ * registered.
+ *
+ * \param busId CAN bus Number
+ * \return 0 on success, a negative value on failure
+ *
+ */
+int canHWSetFilterFromHandlers(int busId);
+
+/*!
+ *
+ * \brief file descriptor of a CAN bus
+ *
+ * \param busId CAN bus Number
+ * \return The descriptor which becomes readable when messages arrive on the
+ *   bus, or -1 if the bus has not been initialized
+ *
+ */
+int canHWGetFd(int busId);
+
 /*!
  *
  * \brief sends a variable length CAN message
@@ -133,6 +133,16 @@ void bin_prnt_int(int number){
 }
 */
 
+void mctrl_accelerationControlStamped(MCTRL_ACC_INPUT *mctrlAccInput, 
+             MCTRL_CONFIG *config, 
+             SMART_MOTION *smartMotion, 
+             double v_command, 
+             SMART_ENGINE *engine)
+{
+  mctrl_accelerationControl(mctrlAccInput, config, smartMotion, v_command,
+    engine, smartMotion->t_curr.tv_sec+smartMotion->t_curr.tv_usec*1e-6);
+}
+
 void mctrl_accelerationControl(MCTRL_ACC_INPUT *mctrlAccInput, 
              MCTRL_CONFIG *config, 
              SMART_MOTION *smartMotion, 
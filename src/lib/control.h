@@ -118,4 +118,14 @@ void mctrl_accelerationControl(MCTRL_ACC_INPUT *mctrlAccInput, MCTRL_CONFIG*
   config, SMART_MOTION* smartMotion, double v_command, SMART_ENGINE* engine,
   double t_curr);
 
+/**
+ * Acceleration control using the receive timestamp of the current
+ * velocity, smartMotion->t_curr, instead of a timestamp taken at
+ * processing time. The velocity derivative is then free of the
+ * scheduling jitter of the calling thread.
+*/
+void mctrl_accelerationControlStamped(MCTRL_ACC_INPUT *mctrlAccInput,
+  MCTRL_CONFIG* config, SMART_MOTION* smartMotion, double v_command,
+  SMART_ENGINE* engine);
+
 #endif
@@ -15,6 +15,9 @@
 #include <sys/time.h>
 #include <time.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <stdio.h>
 
@@ -26,17 +29,292 @@
 
 struct timeval      tv;
 
-/* PID controller variables */
-static double e, old_e;
-static double h;
-static double Integral;
-double tmp;
+/* PID controller of cstSteeringPID() */
+static SMART_PID cst_steering_pid = {
+  .integral_limit = CST_PID_INTEGRAL_LIMIT,
+  .offset = CST_PID_NEUTRAL_OUTPUT,
+};
 
 /* can message */ 
 char msg[8];
 int canId;
 
 
+/*! \brief Mapping of a CST variable to a CAN ID */
+typedef struct CST_VARIABLE
+{
+  unsigned char direction; ///< 0 for write access, 1 for read access
+  unsigned char variable; ///< The variable
+  int can_id; ///< CAN ID accessing the variable
+} CST_VARIABLE;
+
+/*! The variable mapping expected by the library */
+static const CST_VARIABLE cst_variables[] = {
+  /* Write access to Var0 by CAN_ID 0x10 */
+  {0x0, 0x0, 0x10},
+  /* Reading access to Var0 by CAN_ID 0x11 */
+  {0x1, 0x0, 0x11},
+  /* Byte variable Var1 for write access by CAN_ID 0x33 */
+  {0x0, 0x1, CST_ALL_CHANNELS_CAN_ID},
+  /* Byte variable Var2 for write access by CAN_ID 0x35 */
+  {0x0, 0x2, CST_PEDAL_CAN_ID}, //CAN ID for voltage set pedal
+  /* Byte variable Var3 for write access by CAN_ID 0x36 */
+  {0x0, 0x3, CST_STEERING_CAN_ID}, //CAN ID for voltage set steering
+};
+#define CST_NUM_VARIABLES (sizeof(cst_variables)/sizeof(CST_VARIABLE))
+
+/* Both outputs are written in one frame, unvalidated and off by default */
+static EBOOL cst_combined = EFALSE;
+
+/* Values sent on the analog outputs per bus */
+static pthread_mutex_t cst_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SMART_CST_OUTPUT_STATS cst_outputs[LIBCAN_MAX_CAN];
+static EBOOL cst_outputs_initialized = EFALSE;
+static double cst_keep_alive = CST_KEEP_ALIVE;
+
+/* Replies of the CST configuration service per command */
+static pthread_mutex_t cst_reply_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cst_reply_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int cst_reply_sequence[256];
+static unsigned char cst_reply_data[256][8];
+
+/*!
+ *
+ * \brief builds the configuration request of a variable
+ *
+ */
+static void cst_variable_request(const CST_VARIABLE *variable,
+  CPC_CAN_MSG_T *request)
+{
+  memset(request, 0, sizeof(CPC_CAN_MSG_T));
+  request->id = CST_REQUEST_CAN_ID;
+  request->length = 5;
+  request->msg[0] = CST_CONFIGURE_VARIABLE;
+  request->msg[1] = variable->direction;
+  request->msg[2] = variable->variable;
+  request->msg[3] = variable->can_id & 0xff;
+  request->msg[4] = (variable->can_id >> 8) & 0xff;
+}
+
+/*!
+ *
+ * \brief stores a reply of the CST configuration service
+ *
+ */
+static void cst_reply_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  const CPC_CAN_MSG_T *reply = &cpcmsg->msg.canmsg;
+  int command;
+
+  if (!reply->length)
+    return;
+  command = reply->msg[0];
+
+  pthread_mutex_lock(&cst_reply_mutex);
+  memset(cst_reply_data[command], 0, 8);
+  memcpy(cst_reply_data[command], reply->msg,
+    (reply->length < 8) ? reply->length : 8);
+  ++cst_reply_sequence[command];
+  pthread_cond_broadcast(&cst_reply_cond);
+  pthread_mutex_unlock(&cst_reply_mutex);
+}
+
+/*!
+ *
+ * \brief monotonic time for the reply timeouts, independent of canGetTime()
+ *
+ */
+static double cst_time(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec+now.tv_nsec*1e-9;
+}
+
+static unsigned int cst_sequence(int command)
+{
+  unsigned int sequence;
+
+  pthread_mutex_lock(&cst_reply_mutex);
+  sequence = cst_reply_sequence[command];
+  pthread_mutex_unlock(&cst_reply_mutex);
+
+  return sequence;
+}
+
+/*!
+ *
+ * \brief waits for a reply to a command
+ *
+ * Busses processed by a reactor deliver the replies from the reactor's
+ * thread, which signals cst_reply_cond. Otherwise the calling thread
+ * processes the bus, or drains its RX ring if a reader thread runs.
+ *
+ * \param sequence Sequence of the command's replies before the request
+ * \param reply Receives the reply, may be 0
+ * \return 0 if the reply arrived, -1 on timeout
+ *
+ */
+static int cst_wait(int busId, int command, unsigned int sequence,
+  double timeout, unsigned char *reply)
+{
+  CAN_BUS *bus = canGetBus(busId);
+  struct timespec wakeup;
+  double deadline = cst_time()+timeout;
+  int result = -1;
+  EBOOL served;
+
+  for (;;) {
+    served = bus && bus->reactor_attached && !bus->reader_running;
+    if (bus && bus->reader_running)
+      canHWDrain(busId, 0);
+    else if (!served)
+      canHWProcess(busId);
+
+    pthread_mutex_lock(&cst_reply_mutex);
+    if (served) {
+      /* Condition variables wait on the realtime clock */
+      clock_gettime(CLOCK_REALTIME, &wakeup);
+      wakeup.tv_sec += (time_t)timeout;
+      wakeup.tv_nsec += (timeout-(time_t)timeout)*1e9;
+      if (wakeup.tv_nsec >= 1000000000L) {
+        wakeup.tv_nsec -= 1000000000L;
+        ++wakeup.tv_sec;
+      }
+      while ((cst_reply_sequence[command] == sequence) &&
+          !pthread_cond_timedwait(&cst_reply_cond, &cst_reply_mutex,
+            &wakeup));
+    }
+    if (cst_reply_sequence[command] != sequence) {
+      if (reply)
+        memcpy(reply, cst_reply_data[command], 8);
+      result = 0;
+    }
+    pthread_mutex_unlock(&cst_reply_mutex);
+
+    if (!result || (cst_time() >= deadline))
+      return result;
+    if (!served)
+      usleep(100);
+    timeout = deadline-cst_time();
+  }
+}
+
+/*!
+ *
+ * \brief sends a request and waits for its reply, repeating it on timeout
+ *
+ * \return 0 if the reply arrived, -1 if all attempts timed out
+ *
+ */
+static int cst_request(int busId, const CPC_CAN_MSG_T *request,
+  unsigned char *reply, SMART_CST_INFO *info)
+{
+  char data[8];
+  unsigned int sequence;
+  int attempt;
+
+  memcpy(data, request->msg, 8);
+  for (attempt = 0; attempt < CST_MAX_RETRIES; ++attempt) {
+    if (attempt)
+      ++info->retries;
+    sequence = cst_sequence(request->msg[0]);
+    my_send_can_message_var_length(busId, request->id, request->length, data);
+    if (!cst_wait(busId, request->msg[0], sequence, CST_ACK_TIMEOUT, reply))
+      return 0;
+  }
+
+  EDBG("ERROR: CST did not answer command 0x%x\n", request->msg[0]);
+  return -1;
+}
+
+/*!
+ *
+ * \brief sends synchronization frames until the module answers
+ *
+ * After every CST_SYNC_BURST frames, the module is switched to
+ * configuration mode and checked for presence.
+ *
+ */
+static int cst_sync(int busId, SMART_CST_INFO *info)
+{
+  char sync[8] = {0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8};
+  char config[2] = {CST_SWITCH_MODE, 0x1}, presence = CST_CHECK_PRESENCE;
+  unsigned int sequence;
+  int i;
+
+  for (i = 1; i <= CST_SYNC_FRAMES; ++i) {
+    my_send_can_message(busId, CST_REQUEST_CAN_ID, sync);
+    usleep(200);
+    if (i % CST_SYNC_BURST)
+      continue;
+
+    sequence = cst_sequence(CST_CHECK_PRESENCE);
+    my_send_can_message_var_length(busId, CST_REQUEST_CAN_ID, 2, config);
+    my_send_can_message_var_length(busId, CST_REQUEST_CAN_ID, 1, &presence);
+    if (!cst_wait(busId, CST_CHECK_PRESENCE, sequence, CST_SYNC_TIMEOUT, 0)) {
+      info->sync_frames = i;
+      return 0;
+    }
+  }
+
+  EDBG("ERROR: CST did not answer after %d synchronization frames\n",
+    CST_SYNC_FRAMES);
+  return -1;
+}
+
+/*!
+ *
+ * \brief asks the module for its identification
+ *
+ */
+static int cst_identify(int busId, SMART_CST_INFO *info)
+{
+  static const int commands[] = {CST_INQUIRE_MANUFACTURER,
+    CST_INQUIRE_PRODUCT, CST_INQUIRE_SERIAL};
+  char *fields[] = {info->manufacturer, info->product, info->serial};
+  CPC_CAN_MSG_T request;
+  unsigned char reply[8];
+  int i;
+
+  memset(&request, 0, sizeof(request));
+  request.id = CST_REQUEST_CAN_ID;
+  request.length = 1;
+  for (i = 0; i < sizeof(commands)/sizeof(int); ++i) {
+    request.msg[0] = commands[i];
+    if (cst_request(busId, &request, reply, info))
+      return -1;
+    memcpy(fields[i], reply+1, 7);
+    fields[i][7] = 0;
+  }
+
+  return 0;
+}
+
+/*!
+ *
+ * \brief writes the expected variable mapping
+ *
+ * Every variable is confirmed by a reply echoing the command, the content
+ * of the reply is not interpreted.
+ *
+ */
+static int cst_configure(int busId, SMART_CST_INFO *info)
+{
+  CPC_CAN_MSG_T request;
+  int i;
+
+  for (i = 0; i < CST_NUM_VARIABLES; ++i) {
+    cst_variable_request(&cst_variables[i], &request);
+    if (cst_request(busId, &request, 0, info))
+      return -1;
+  }
+  info->configured = ETRUE;
+
+  return 0;
+}
+
 /*!
  *
  * \brief Initializing the CST analog output unit
@@ -48,7 +326,9 @@ int canId;
  */ 
 void cstInit(int busId)
 {
-  int i;
+  CPC_CAN_MSG_T config[CST_NUM_VARIABLES+2];
+  int status[CST_NUM_VARIABLES+2];
+  int i, sent;
 
   //Syncronization
   canId=0x7e5;
@@ -104,62 +384,71 @@ void cstInit(int busId)
 
 
   //configuring variables
-  msg[0]=0x4; //switch to config mode
-  msg[1]=0x1;
-  my_send_can_message_var_length(busId, canId, 2, msg);
-
   /* Var0 : read status
      Var0 : write control
      Var1 : write all channels
      Var2 : write channel 0
      Var3 : write channel 1
   */
-
-  /* Configure write access to Var0 by CAN_ID 0x10 */
-  msg[0]=0x80;
-  msg[1]=0x0;
-  msg[2]=0x0;  
-  msg[3]=0x10;
-  msg[4]=0x0;
-  my_send_can_message_var_length(busId, canId, 5, msg);
-
-  /* Configure reading access to Var0 by CAN_ID 0x11 */
-  msg[0]=0x80;
-  msg[1]=0x1;
-  msg[2]=0x0;  
-  msg[3]=0x11;
-  msg[4]=0x0;
-  my_send_can_message_var_length(busId, canId, 5, msg); 
-
-  /* Configure byte variable Var1 for write access by CAN_ID 0x33 */
-  msg[0]=0x80;
-  msg[1]=0x0;
-  msg[2]=0x1;  
-  msg[3]=0x33;
-  msg[4]=0x0;
-  my_send_can_message_var_length(busId, canId, 5, msg);
-
-  /* Configure byte variable Var2 for write access by CAN_ID 0x35 */
-  msg[0]=0x80;
-  msg[1]=0x0;
-  msg[2]=0x2;  
-  msg[3]=0x35; //CAN ID for voltage set pedal
-  msg[4]=0x0;
-  my_send_can_message_var_length(busId, canId, 5, msg);
-
-  /* Configure byte variable Var3 for write access by CAN_ID 0x36 */
-  msg[0]=0x80;
-  msg[1]=0x0;
-  msg[2]=0x3;  
-  msg[3]=0x36; //CAN ID for voltage set steering
-  msg[4]=0x0;
-  my_send_can_message_var_length(busId, canId, 5, msg);
-  
-  msg[0]=0x4; //switch to operation mode
-  msg[1]=0x0;
-  my_send_can_message_var_length(busId, canId,2, msg);
+  memset(config, 0, sizeof(config));
+  /* Switch to config mode */
+  config[0].id = CST_REQUEST_CAN_ID;
+  config[0].length = 2;
+  config[0].msg[0] = CST_SWITCH_MODE;
+  config[0].msg[1] = 0x1;
+  for (i = 0; i < CST_NUM_VARIABLES; ++i)
+    cst_variable_request(&cst_variables[i], &config[i+1]);
+  /* Switch to operation mode */
+  config[i+1].id = CST_REQUEST_CAN_ID;
+  config[i+1].length = 2;
+  config[i+1].msg[0] = CST_SWITCH_MODE;
+  config[i+1].msg[1] = 0x0;
+
+  sent = canHWSendBatch(busId, config, CST_NUM_VARIABLES+2, status);
+  if (sent != CST_NUM_VARIABLES+2)
+    EDBG("ERROR: sent %d of %d CST configuration frames\n", sent,
+      (int)(CST_NUM_VARIABLES+2));
+  cstResetOutputs(busId);
   EDBG("CST configuration finished\n");
-  old_e=0;
+  cstPIDReset(&cst_steering_pid);
+}
+
+int cstInitFast(int busId, SMART_CST_INFO *info)
+{
+  SMART_CST_INFO local;
+  char operation[2] = {CST_SWITCH_MODE, 0x0};
+  double start = cst_time();
+  int result;
+
+  if (!info)
+    info = &local;
+  memset(info, 0, sizeof(SMART_CST_INFO));
+
+  if (canAddIdHandler(busId, CST_REPLY_CAN_ID, cst_reply_handler))
+    result = -1;
+  else {
+    result = cst_sync(busId, info);
+    if (!result)
+      result = cst_identify(busId, info);
+    if (!result)
+      result = cst_configure(busId, info);
+    canRemoveIdHandler(busId, CST_REPLY_CAN_ID, cst_reply_handler);
+  }
+
+  if (result) {
+    EDBG("WARNING: CST did not confirm its configuration, "
+      "falling back to the blind initialisation\n");
+    cstInit(busId);
+    return -1;
+  }
+
+  my_send_can_message_var_length(busId, CST_REQUEST_CAN_ID, 2, operation);
+  cstResetOutputs(busId);
+  EDBG("CST %s %s (serial %s) configured after %.3f sec\n",
+    info->manufacturer, info->product, info->serial, cst_time()-start);
+  cstPIDReset(&cst_steering_pid);
+
+  return 0;
 }
 
 /*!
@@ -186,24 +475,171 @@ void cst_send_speed_msg(int busId)
   my_send_can_message(busId, canId,msg);
 }
 
+/*!
+ *
+ * \brief finds the output cache of a bus
+ *
+ * Must be called with cst_output_mutex held.
+ *
+ * \return The cache, 0 for an invalid bus
+ *
+ */
+static SMART_CST_OUTPUT_STATS* cst_output_stats(int busId)
+{
+  int i, j;
+
+  if ((busId < 0) || (busId >= LIBCAN_MAX_CAN))
+    return 0;
+
+  /* All values are unknown until the first one is sent */
+  if (!cst_outputs_initialized) {
+    for (i = 0; i < LIBCAN_MAX_CAN; ++i)
+      for (j = 0; j < CST_NUM_CHANNELS; ++j)
+        cst_outputs[i].channels[j].value = -1;
+    cst_outputs_initialized = ETRUE;
+  }
+
+  return &cst_outputs[busId];
+}
+
+/*!
+ *
+ * \brief checks if a value of an output needs to be sent
+ *
+ * Must be called with cst_output_mutex held.
+ *
+ */
+static EBOOL cst_output_due(const SMART_CST_OUTPUT_STATS *outputs,
+  int channel, int value, double now)
+{
+  const SMART_CST_OUTPUT *output = &outputs->channels[channel];
+
+  return (value != output->value) ||
+    (now-output->timestamp >= cst_keep_alive);
+}
+
+/*!
+ *
+ * \brief records a value of an output as sent or suppressed
+ *
+ * Must be called with cst_output_mutex held.
+ *
+ */
+static void cst_output_record(SMART_CST_OUTPUT_STATS *outputs, int channel,
+  int value, double now, EBOOL sent)
+{
+  SMART_CST_OUTPUT *output = &outputs->channels[channel];
+
+  if (sent) {
+    output->value = value;
+    output->timestamp = now;
+    ++output->sent;
+  }
+  else
+    ++output->suppressed;
+}
+
+/*!
+ *
+ * \brief takes back values recorded as sent, but failed to be sent
+ *
+ */
+static void cst_output_failed(int busId, const int *channels, int count)
+{
+  SMART_CST_OUTPUT_STATS *outputs;
+  int i;
+
+  pthread_mutex_lock(&cst_output_mutex);
+  outputs = cst_output_stats(busId);
+  for (i = 0; i < count; ++i) {
+    outputs->channels[channels[i]].value = -1;
+    --outputs->channels[channels[i]].sent;
+  }
+  --outputs->frames;
+  pthread_mutex_unlock(&cst_output_mutex);
+}
+
+/*!
+ *
+ * \brief converts a voltage to the 12bit value of an analog output
+ *
+ */
+static int cst_output_value(double voltage)
+{
+  return (voltage/V_MAX)*4096;
+}
+
+/*!
+ *
+ * \brief converts a pedal value in percent to the voltage of the egas
+ *
+ * \return EFALSE if the pedal value is out of [0, 100]
+ *
+ */
+static EBOOL cst_pedal_voltage(double p, double *voltage)
+{
+  if ((p<0)||(p>100)) {
+    EDBG("ERROR: pedal value %f out of range!\n", p);
+    return EFALSE;
+  }
+  *voltage = 0.0182 * p*2.5 + 0.5325;
+
+  return ETRUE;
+}
+
+/*!
+ *
+ * \brief checks the voltage of the power steering against its limits
+ *
+ */
+static EBOOL cst_steering_valid(double voltage)
+{
+  if ((voltage>STEERING_PHYSICAL_MAX_LIMIT)||
+      (voltage<STEERING_PHYSICAL_MIN_LIMIT)) {
+    EDBG("ERROR: voltage for steering out of physical limits\n");
+    return EFALSE;
+  }
+
+  return ETRUE;
+}
+
 void cstIntSetVoltage(int busId,int voltage, int channel)
 {
   /*sends a can message to the CST analoge output device containing
     a voltage as a 12bit integer voltage 
-    The maximal voltage of 10V coresponds to an int of 4096 (decimal)*/
-
-  if (voltage<4096) //check if more then 12bit is requested
+    The maximal voltage of 10V coresponds to an int of 4096 (decimal)
+    Unchanged voltages are only sent after the keep-alive interval */
+  SMART_CST_OUTPUT_STATS *outputs;
+  char data[2];
+  double now;
+  EBOOL due;
+
+  if ((channel<0)||(channel>=CST_NUM_CHANNELS))
+    EDBG("Error: invalid CST channel %d\n",channel);
+  else if ((busId<0)||(busId>=LIBCAN_MAX_CAN))
+    EDBG("Error: invalid CAN bus %d\n",busId);
+  else if (voltage<4096) //check if more then 12bit is requested
     
     {
-      if (channel==0) //pedal
-	canId=0x35; 
-      else if (channel==1) //steering
-	canId=0x36;
-      
-      msg[0]=(voltage & 0x00ff);
-      msg[1]=(voltage & 0xff00)>>8;
-
-      my_send_can_message_var_length(busId, canId,2, msg);
+      now = canGetTime();
+      pthread_mutex_lock(&cst_output_mutex);
+      outputs = cst_output_stats(busId);
+      due = cst_output_due(outputs, channel, voltage, now);
+      cst_output_record(outputs, channel, voltage, now, due);
+      if (due)
+        ++outputs->frames;
+      else
+        ++outputs->suppressed_frames;
+      pthread_mutex_unlock(&cst_output_mutex);
+      if (!due)
+        return;
+
+      data[0]=(voltage & 0x00ff);
+      data[1]=(voltage & 0xff00)>>8;
+
+      if (canHWQueue(busId, channel ? CST_STEERING_CAN_ID : CST_PEDAL_CAN_ID,
+          2, data, 0))
+        cst_output_failed(busId, &channel, 1);
     }
   else
     EDBG("Error: voltage is 12bit. Maximum voltage in int: 4096. You requested %d\n",voltage);
@@ -213,34 +649,113 @@ void cstDoubleSetVoltage(int busId, double voltage, int channel)
 /* Sets a voltage given as double on the CST analoge
    output device */
 {
-  tmp = (voltage/V_MAX)*4096;
-  cstIntSetVoltage(busId,(int) tmp, channel);
+  cstIntSetVoltage(busId, cst_output_value(voltage), channel);
 }
 
 
 /* public function to set the voltage for the active steering */
 void cstSetSteeringVoltage(int busId, double voltage)
 {
-  if ((voltage<=STEERING_PHYSICAL_MAX_LIMIT)&&(voltage>=STEERING_PHYSICAL_MIN_LIMIT))
+  if (cst_steering_valid(voltage))
     cstDoubleSetVoltage(busId,voltage,1);
-  else
-    EDBG("ERROR: voltage for steering out of physical limits\n");
 }
 
 /* public function to set pedal value in percent */
 void cstSetPedalValue(int busId,double p)
 /* sets a pedal value in percent of pedal pressed*/
 {
-  p=p*2.5;
-  if ((p>=0)&&(p<=250))
-    cstDoubleSetVoltage(busId, 0.0182 * p + 0.5325,0);
-  else
-    EDBG("ERROR: pedal value too high!\n");
+  double voltage;
+
+  if (cst_pedal_voltage(p, &voltage))
+    cstDoubleSetVoltage(busId, voltage, 0);
+}
+
+int cstSetOutputs(int busId, double p, double voltage)
+{
+  static const int channels[] = {0, 1};
+  SMART_CST_OUTPUT_STATS *stats;
+  char outputs[4];
+  int pedal, steering;
+  double now, pedal_voltage;
+  EBOOL due;
+
+  if ((busId < 0) || (busId >= LIBCAN_MAX_CAN)) {
+    EDBG("ERROR: invalid CAN bus %d\n", busId);
+    return -1;
+  }
+  if (!cst_pedal_voltage(p, &pedal_voltage) || !cst_steering_valid(voltage))
+    return -1;
+
+  pedal = cst_output_value(pedal_voltage);
+  steering = cst_output_value(voltage);
+
+  if (cst_combined) {
+    /* Both values are sent if either one is due */
+    now = canGetTime();
+    pthread_mutex_lock(&cst_output_mutex);
+    stats = cst_output_stats(busId);
+    due = cst_output_due(stats, 0, pedal, now) ||
+      cst_output_due(stats, 1, steering, now);
+    cst_output_record(stats, 0, pedal, now, due);
+    cst_output_record(stats, 1, steering, now, due);
+    if (due)
+      ++stats->frames;
+    else
+      ++stats->suppressed_frames;
+    pthread_mutex_unlock(&cst_output_mutex);
+    if (!due)
+      return 0;
+
+    outputs[0] = pedal & 0xff;
+    outputs[1] = (pedal >> 8) & 0xff;
+    outputs[2] = steering & 0xff;
+    outputs[3] = (steering >> 8) & 0xff;
+    if (!canHWQueue(busId, CST_ALL_CHANNELS_CAN_ID, 4, outputs, 0))
+      return 0;
+    cst_output_failed(busId, channels, CST_NUM_CHANNELS);
+  }
+
+  cstIntSetVoltage(busId, pedal, 0);
+  cstIntSetVoltage(busId, steering, 1);
+
+  return 0;
+}
+
+void cstSetCombinedWrite(EBOOL enable)
+{
+  cst_combined = enable;
+}
+
+void cstSetKeepAlive(double interval)
+{
+  pthread_mutex_lock(&cst_output_mutex);
+  cst_keep_alive = interval;
+  pthread_mutex_unlock(&cst_output_mutex);
+}
+
+void cstResetOutputs(int busId)
+{
+  SMART_CST_OUTPUT_STATS *outputs;
+  int i;
+
+  pthread_mutex_lock(&cst_output_mutex);
+  if ((outputs = cst_output_stats(busId)))
+    for (i = 0; i < CST_NUM_CHANNELS; ++i)
+      outputs->channels[i].value = -1;
+  pthread_mutex_unlock(&cst_output_mutex);
 }
 
-const  double arw = 0.22;
-static double x1;
-static double tempo;
+int cstGetOutputStats(int busId, SMART_CST_OUTPUT_STATS *stats)
+{
+  SMART_CST_OUTPUT_STATS *outputs;
+
+  pthread_mutex_lock(&cst_output_mutex);
+  if ((outputs = cst_output_stats(busId)))
+    *stats = *outputs;
+  pthread_mutex_unlock(&cst_output_mutex);
+
+  return outputs ? 0 : -1;
+}
 
 /* Optimal PID values according to Lamon Method:
 
@@ -249,22 +764,55 @@ I = 0.2
 D = 0.4
 */
 
-/* Takes a target steering angle and current steering angle in radiants on the wheel and calulates the needed voltage output */
-void cstSteeringPID(double P, double I, double D, double t, double target, 
-  double current_value, double old_steering_voltage, double *output) {
-  e = current_value - target;
+void cstPIDInit(SMART_PID *pid, const SMART_PID_STR *gains)
+{
+  pid->gains = *gains;
+  pid->integral_limit = CST_PID_INTEGRAL_LIMIT;
+  pid->offset = CST_PID_NEUTRAL_OUTPUT;
+  cstPIDReset(pid);
+}
 
-  x1 = Integral + e*t;
-  
-  if(fabs(x1) > arw)
-    x1 = arw;
+void cstPIDReset(SMART_PID *pid)
+{
+  pid->integral = 0.0;
+  pid->error = 0.0;
+}
 
-  tempo = 2.5 + P*e + I*x1 + D*(e-old_e)/t; 
+double cstPIDStep(SMART_PID *pid, double t, double target, double current_value)
+{
+  double e = current_value - target;
+  double integral = pid->integral + e*t;
+  double output;
+
+  if (integral > pid->integral_limit)
+    integral = pid->integral_limit;
+  else if (integral < -pid->integral_limit)
+    integral = -pid->integral_limit;
 
-  Integral = x1;
-  old_e = e;
+  output = pid->offset + pid->gains.p*e + pid->gains.i*integral +
+    pid->gains.d*(e-pid->error)/t;
 
-  *output = tempo;
+  pid->integral = integral;
+  pid->error = e;
+
+  return output;
+}
+
+void cstPIDStepBatch(SMART_PID *pids, int count, double t,
+  const double *targets, const double *current_values, double *outputs)
+{
+  int i;
+
+  for (i = 0; i < count; ++i)
+    outputs[i] = cstPIDStep(&pids[i], t, targets[i], current_values[i]);
+}
+
+/* Takes a target steering angle and current steering angle in radiants on the wheel and calulates the needed voltage output */
+void cstSteeringPID(double P, double I, double D, double t, double target, 
+  double current_value, double old_steering_voltage, double *output) {
+  cst_steering_pid.gains.p = P;
+  cst_steering_pid.gains.i = I;
+  cst_steering_pid.gains.d = D;
 
-  //EDBG("Steering PID:\n error=%f P=%f I=%f D=%f tempo=%f \n",e,P,I,D,tempo);
+  *output = cstPIDStep(&cst_steering_pid, t, target, current_value);
 }
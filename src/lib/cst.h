@@ -34,6 +34,42 @@
 */
 #define STEERING_PHYSICAL_MIN_LIMIT (0.5) 
 
+/*! CAN ID writing both analog outputs (Var1) */
+#define CST_ALL_CHANNELS_CAN_ID 0x33
+/*! CAN ID writing the pedal output, channel 0 (Var2) */
+#define CST_PEDAL_CAN_ID 0x35
+/*! CAN ID writing the steering output, channel 1 (Var3) */
+#define CST_STEERING_CAN_ID 0x36
+
+/*! Number of analog outputs */
+#define CST_NUM_CHANNELS 2
+/*! Default interval in [s] after which an unchanged output is resent */
+#define CST_KEEP_ALIVE (0.1)
+
+/*! CAN ID of the requests to the CST configuration service */
+#define CST_REQUEST_CAN_ID 0x7e5
+/*! CAN ID of the replies of the CST configuration service */
+#define CST_REPLY_CAN_ID 0x7e4
+
+/*! Configuration service commands, replies echo the command in byte 0 */
+#define CST_SWITCH_MODE 0x04
+#define CST_INQUIRE_MANUFACTURER 0x24
+#define CST_INQUIRE_PRODUCT 0x25
+#define CST_INQUIRE_SERIAL 0x26
+#define CST_CONFIGURE_VARIABLE 0x80
+#define CST_CHECK_PRESENCE 0x82
+
+/*! Maximum number of synchronization frames */
+#define CST_SYNC_FRAMES 500
+/*! Synchronization frames sent between two presence checks */
+#define CST_SYNC_BURST 10
+/*! Time to wait for the reply to a presence check while synchronizing in [s] */
+#define CST_SYNC_TIMEOUT 0.005
+/*! Time to wait for the reply to a configuration request in [s] */
+#define CST_ACK_TIMEOUT 0.05
+/*! Number of attempts per configuration request */
+#define CST_MAX_RETRIES 5
+
 /*! \brief Struct holding P, I and D for PID Controller
  */
 typedef struct SMART_PID_STR
@@ -43,6 +79,53 @@ typedef struct SMART_PID_STR
   double d;
 } SMART_PID_STR;
 
+/*! Limit of the integrated steering error (anti-windup) */
+#define CST_PID_INTEGRAL_LIMIT (0.22)
+/*! Steering voltage at which the power steering applies no torque */
+#define CST_PID_NEUTRAL_OUTPUT (2.5)
+
+/*! \brief PID controller holding its own gains and state
+ */
+typedef struct SMART_PID
+{
+  SMART_PID_STR gains; ///< P, I and D
+  double integral_limit; ///< Limit of the integrated error (anti-windup)
+  double offset; ///< Output at zero error
+  double integral; ///< Integrated error
+  double error; ///< Error of the last step
+} SMART_PID;
+
+/*! \brief Identification reported by the CST during initialisation
+ */
+typedef struct SMART_CST_INFO
+{
+  char manufacturer[8]; ///< Manufacturer name, zero terminated
+  char product[8]; ///< Product name, zero terminated
+  char serial[8]; ///< Serial number, zero terminated
+  int sync_frames; ///< Synchronization frames sent until the module answered
+  int retries; ///< Requests repeated for lack of a reply
+  EBOOL configured; ///< Every variable of the mapping was confirmed
+} SMART_CST_INFO;
+
+/*! \brief Output cache of an analog output of the CST
+ */
+typedef struct SMART_CST_OUTPUT
+{
+  int value; ///< Last 12bit value sent, -1 if unknown
+  double timestamp; ///< Time of canGetTime() the value was sent
+  unsigned long sent; ///< Values sent
+  unsigned long suppressed; ///< Values not sent for being unchanged
+} SMART_CST_OUTPUT;
+
+/*! \brief Statistics of the analog output writes on a bus
+ */
+typedef struct SMART_CST_OUTPUT_STATS
+{
+  SMART_CST_OUTPUT channels[CST_NUM_CHANNELS]; ///< Pedal and steering
+  unsigned long frames; ///< Frames sent
+  unsigned long suppressed_frames; ///< Frames not sent
+} SMART_CST_OUTPUT_STATS;
+
 /*! \brief Debug struct for the CST (Analog Output module) that commands the
 electric power steering and e-gas unit
  */
@@ -98,6 +181,67 @@ void cstSetPedalValue(int busId, double p);
  */
 void cstSetSteeringVoltage(int busId, double voltage);
 
+/*!
+ *
+ * \brief Setting the pedal value and the steering voltage at once
+ *
+ * By default, two frames are sent as by cstSetPedalValue() and
+ * cstSetSteeringVoltage(). If the combined write is enabled, both outputs
+ * are written in one frame to CST_ALL_CHANNELS_CAN_ID instead, falling
+ * back to two frames if the frame cannot be queued. No output is set if either value is out of its
+ * limits. The frame is suppressed if neither value is due, see
+ * cstSetKeepAlive().
+ *
+ * \param p How much the gas pedal is pressed (in percent)
+ * \param voltage Voltage to be apllied to the Power Steering
+ * \return 0 on success, -1 if a value is out of its limits
+ *
+ */
+int cstSetOutputs(int busId, double p, double voltage);
+
+/*!
+ *
+ * \brief Enabling the single frame write of both outputs
+ *
+ * The combined write is disabled by default, neither initialisation
+ * enables it. The frame holds the 12bit values of channel 0 (pedal) and
+ * channel 1 (steering) as little endian words, a layout of Var1 which has
+ * not been validated on the module. Since data frames are not
+ * acknowledged, a wrong layout silently stops both outputs.
+ *
+ * \warning configuration of the two in one message does not work
+ *
+ */
+void cstSetCombinedWrite(EBOOL enable);
+
+/*!
+ *
+ * \brief Setting the keep-alive interval of the analog outputs
+ *
+ * A value is only sent if its 12bit quantisation differs from the last
+ * value sent on its channel of the same bus, or if the last value was sent longer than
+ * the keep-alive interval ago. The default is CST_KEEP_ALIVE.
+ *
+ * \param interval Keep-alive interval in [s], 0 to send every value
+ */
+void cstSetKeepAlive(double interval);
+
+/*!
+ *
+ * \brief Forgetting the values sent on the analog outputs of a bus
+ *
+ * The next value of each channel is sent. Called by the initialisation.
+ */
+void cstResetOutputs(int busId);
+
+/*!
+ *
+ * \brief Statistics of the analog output writes on a bus
+ *
+ * \return 0 on success, -1 for an invalid bus
+ */
+int cstGetOutputStats(int busId, SMART_CST_OUTPUT_STATS *stats);
+
 /*!
  *
  * \brief Initializing the CST analog output unit
@@ -109,12 +253,41 @@ void cstSetSteeringVoltage(int busId, double voltage);
  */ 
 void cstInit(int busId);
 
+/*!
+ *
+ * \brief Initializing the CST analog output unit with acknowledgements
+ *
+ * Performs the configuration of cstInit(), but listens for the replies of
+ * the module on CST_REPLY_CAN_ID and proceeds as soon as a step is
+ * confirmed. Synchronization frames are only sent until the module
+ * answers a presence check, and every request is repeated up to
+ * CST_MAX_RETRIES times if its reply does not arrive within
+ * CST_ACK_TIMEOUT. The variable mapping is written on every
+ * initialisation.
+ *
+ * If a reactor processes the bus, the replies are awaited from its thread,
+ * so the function must not be called from the reactor's own handlers.
+ * Otherwise the replies are handled by the calling thread, through
+ * canHWDrain() if a reader thread runs and canHWProcess() if not, so no
+ * other thread may handle the bus meanwhile. The bus filter must accept
+ * CST_REPLY_CAN_ID. If the module does not confirm a step, the blind
+ * configuration of cstInit() is performed instead.
+ *
+ * \param busId CAN bus the CST is attached to
+ * \param info Receives the identification of the module, may be 0
+ * \return 0 if all steps were confirmed, -1 if cstInit() was used instead
+ */
+int cstInitFast(int busId, SMART_CST_INFO *info);
+
 /*!
  *
  * \brief Cycle of the PID control for the steering unit
  *
  * This PID controls the steering position of the car by comparing the actual steering wheel position measured by the car's sttering wheel angle sensor to a desired steering wheel angle given by the user or read from a higher level (commanding) module. 
  *
+ * The state is kept in a controller shared by all callers and reset by
+ * cstInit(). Use a SMART_PID and cstPIDStep() for independent controllers.
+ *
  * \param P P
  * \param I I
  * \param D D
@@ -125,5 +298,53 @@ void cstInit(int busId);
  * \param the voltage to apply now
  */
 void cstSteeringPID(double P, double I, double D, double t, double target, double current_value, double old_steering_voltage, double *output);
+
+/*!
+ *
+ * \brief Initializing a steering PID controller
+ *
+ * The integral limit and the offset are set to CST_PID_INTEGRAL_LIMIT and
+ * CST_PID_NEUTRAL_OUTPUT, and the state is reset.
+ *
+ * \param gains P, I and D
+ */
+void cstPIDInit(SMART_PID *pid, const SMART_PID_STR *gains);
+
+/*!
+ *
+ * \brief Resetting the integrated and last error of a PID controller
+ */
+void cstPIDReset(SMART_PID *pid);
+
+/*!
+ *
+ * \brief Cycle of a PID controller
+ *
+ * Controllers do not share any state, such that different controllers may
+ * be stepped from different threads.
+ *
+ * \param t the sampling time
+ * \param target the desired steering angle (in radients at the wheel)
+ * \param current_value the actual steering angle (in radients at the wheel)
+ * \return the voltage to apply now
+ */
+double cstPIDStep(SMART_PID *pid, double t, double target, double current_value);
+
+/*!
+ *
+ * \brief Cycle of many PID controllers at once
+ *
+ * Advances each controller as cstPIDStep() would, e.g. to evaluate sets
+ * of gains against the same or different measurements.
+ *
+ * \param pids The controllers
+ * \param count Number of controllers
+ * \param t the sampling time
+ * \param targets the desired steering angle of each controller
+ * \param current_values the actual steering angle of each controller
+ * \param outputs receives the voltage of each controller
+ */
+void cstPIDStepBatch(SMART_PID *pids, int count, double t,
+  const double *targets, const double *current_values, double *outputs);
 /*@}*/
 #endif
@@ -0,0 +1,203 @@
+/*!
+ *  \file esx.c
+ *
+ *  \brief State machine following the requests of the security ECU (ESX)
+ *
+ * The state is changed with esx_mutex held, while the handlers and
+ * actions are called after releasing it, such that they may read the
+ * status.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include <libelrob/Edebug.h>
+
+#include "esx.h"
+
+/*! \brief Registered handler */
+typedef struct SMART_ESX_CALLBACK {
+  SMART_ESX_HANDLER handler; ///< The handler
+  void *data; ///< User data passed to the handler
+} SMART_ESX_CALLBACK;
+
+static SMART_ESX_STATUS esx_status;
+static pthread_mutex_t esx_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static SMART_ESX_CALLBACK esx_handlers[SMART_ESX_MAX_HANDLERS];
+static int esx_num_handlers = 0;
+static SMART_ESX_CALLBACK esx_actions[SMART_ESX_MAX_HANDLERS];
+static int esx_num_actions = 0;
+
+/*!
+ *
+ * \brief state requested by an ESX message
+ *
+ */
+static SMART_ESX_STATE esx_requested(const ESX_STR *state)
+{
+  if (state->request_stop)
+    return SMART_ESX_STOP;
+  if (state->request_pause)
+    return SMART_ESX_PAUSE;
+  if (state->control_lateral && state->control_longitudinal)
+    return SMART_ESX_AUTONOMOUS;
+  if (state->control_lateral)
+    return SMART_ESX_LATERAL;
+  if (state->control_longitudinal)
+    return SMART_ESX_LONGITUDINAL;
+
+  return SMART_ESX_MANUAL;
+}
+
+/*!
+ *
+ * \brief checks if the car is under control in a state
+ *
+ */
+static EBOOL esx_controlled(SMART_ESX_STATE state)
+{
+  return (state == SMART_ESX_LATERAL) || (state == SMART_ESX_LONGITUDINAL) ||
+    (state == SMART_ESX_AUTONOMOUS) || (state == SMART_ESX_PAUSE);
+}
+
+/*!
+ *
+ * \brief registers a callback
+ *
+ */
+static int esx_add(SMART_ESX_CALLBACK *callbacks, int *num_callbacks,
+  SMART_ESX_HANDLER handler, void *data)
+{
+  int result = -1;
+
+  pthread_mutex_lock(&esx_mutex);
+  if (*num_callbacks < SMART_ESX_MAX_HANDLERS) {
+    callbacks[*num_callbacks].handler = handler;
+    callbacks[*num_callbacks].data = data;
+    __atomic_store_n(num_callbacks, *num_callbacks+1, __ATOMIC_RELEASE);
+    result = 0;
+  }
+  pthread_mutex_unlock(&esx_mutex);
+
+  if (result)
+    EDBG("ERROR: too many ESX handlers\n");
+
+  return result;
+}
+
+/*!
+ *
+ * \brief calls the safe-stop actions and the handlers of a transition
+ *
+ */
+static void esx_dispatch(const SMART_ESX_EVENT *event, EBOOL stop)
+{
+  int i, count;
+
+  if (stop) {
+    count = __atomic_load_n(&esx_num_actions, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; ++i)
+      esx_actions[i].handler(event, esx_actions[i].data);
+  }
+
+  count = __atomic_load_n(&esx_num_handlers, __ATOMIC_ACQUIRE);
+  for (i = 0; i < count; ++i)
+    esx_handlers[i].handler(event, esx_handlers[i].data);
+}
+
+int smartEsxAddHandler(SMART_ESX_HANDLER handler, void *data)
+{
+  return esx_add(esx_handlers, &esx_num_handlers, handler, data);
+}
+
+int smartEsxAddStopAction(SMART_ESX_HANDLER action, void *data)
+{
+  return esx_add(esx_actions, &esx_num_actions, action, data);
+}
+
+void smartEsxGetStatus(SMART_ESX_STATUS *status)
+{
+  pthread_mutex_lock(&esx_mutex);
+  *status = esx_status;
+  pthread_mutex_unlock(&esx_mutex);
+}
+
+void smartEsxUpdate(const ESX_STR *state, double timestamp)
+{
+  SMART_ESX_EVENT event;
+  EBOOL stop = EFALSE;
+
+  event.requested = esx_requested(state);
+  event.timestamp = timestamp;
+  event.esx = *state;
+
+  pthread_mutex_lock(&esx_mutex);
+  esx_status.timestamp = timestamp;
+  event.from = esx_status.state;
+  if (event.requested == event.from) {
+    pthread_mutex_unlock(&esx_mutex);
+    return;
+  }
+
+  /* The stop state is only left towards manual mode */
+  event.valid = (event.from != SMART_ESX_STOP) ||
+    (event.requested == SMART_ESX_MANUAL);
+  if (event.valid) {
+    event.to = event.requested;
+    esx_status.state = event.to;
+    esx_status.since = timestamp;
+    ++esx_status.transitions;
+    if (event.to == SMART_ESX_STOP) {
+      ++esx_status.stops;
+      stop = ETRUE;
+    }
+  }
+  else {
+    event.to = event.from;
+    ++esx_status.invalid;
+  }
+  pthread_mutex_unlock(&esx_mutex);
+
+  if (!event.valid)
+    EDBG("WARNING: invalid ESX transition from %d to %d\n", event.from,
+      event.requested);
+  esx_dispatch(&event, stop);
+}
+
+EBOOL smartEsxCheck(double now)
+{
+  SMART_ESX_EVENT event;
+  EBOOL stop;
+
+  pthread_mutex_lock(&esx_mutex);
+  if ((esx_status.state == SMART_ESX_UNKNOWN) ||
+      (esx_status.state == SMART_ESX_STOP) ||
+      (now-esx_status.timestamp <= SMART_ESX_STALE_PERIODS*SMART_ESX_PERIOD)) {
+    stop = (now-esx_status.timestamp >
+      SMART_ESX_STALE_PERIODS*SMART_ESX_PERIOD);
+    pthread_mutex_unlock(&esx_mutex);
+    return stop;
+  }
+
+  /* A loss under control is latched like a stop request */
+  memset(&event, 0, sizeof(event));
+  event.from = esx_status.state;
+  event.requested = SMART_ESX_UNKNOWN;
+  stop = esx_controlled(event.from);
+  event.to = stop ? SMART_ESX_STOP : SMART_ESX_UNKNOWN;
+  event.valid = ETRUE;
+  event.timestamp = now;
+
+  esx_status.state = event.to;
+  esx_status.since = now;
+  ++esx_status.transitions;
+  if (stop)
+    ++esx_status.stops;
+  pthread_mutex_unlock(&esx_mutex);
+
+  EDBG("WARNING: lost the ESX messages\n");
+  esx_dispatch(&event, stop);
+
+  return ETRUE;
+}
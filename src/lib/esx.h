@@ -0,0 +1,134 @@
+#ifndef SMART_ESX_H
+#define SMART_ESX_H
+
+#include <libelrob/Etypes.h>
+
+#include "smart.h"
+
+/*! \defgroup smartlibesx ESX safety state machine
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file esx.h
+ *
+ *  \brief State machine following the requests of the security ECU (ESX)
+ *
+ * Every ESX state message (0x88) is mapped to a state, stop and pause
+ * requests taking precedence over the granted control modes. Transitions
+ * are validated and timestamped with the receive time of the message.
+ * The stop state is latched: it is only left towards manual mode, once
+ * the ESX has withdrawn both the stop request and the control modes.
+ *
+ * Transition handlers and safe-stop actions are called from the receive
+ * path, right after the message was decoded. Safe-stop actions run when
+ * the ESX requests a stop, and when its messages stop arriving while the
+ * car is under control, which smartEsxCheck() detects.
+ */
+
+/*! \brief Nominal period of the ESX state message in [s] */
+#define SMART_ESX_PERIOD 0.1
+/*! \brief Number of nominal periods after which the ESX is considered lost */
+#define SMART_ESX_STALE_PERIODS 3.0
+/*! \brief Maximum number of transition handlers and safe-stop actions */
+#define SMART_ESX_MAX_HANDLERS 8
+
+/*! \brief State of the ESX */
+typedef enum SMART_ESX_STATE {
+  SMART_ESX_UNKNOWN, ///< No message received, or lost in manual mode
+  SMART_ESX_MANUAL, ///< No control granted
+  SMART_ESX_LATERAL, ///< Lateral control granted
+  SMART_ESX_LONGITUDINAL, ///< Longitudinal control granted
+  SMART_ESX_AUTONOMOUS, ///< Lateral and longitudinal control granted
+  SMART_ESX_PAUSE, ///< Pause requested
+  SMART_ESX_STOP ///< Stop requested or messages lost under control, latched
+} SMART_ESX_STATE;
+
+/*! \brief Transition of the ESX state */
+typedef struct SMART_ESX_EVENT {
+  SMART_ESX_STATE from; ///< Previous state
+  SMART_ESX_STATE to; ///< New state, the previous one if invalid
+  SMART_ESX_STATE requested; ///< State requested by the message
+  EBOOL valid; ///< The transition was accepted
+  double timestamp; ///< Receive timestamp of the message in [s]
+  ESX_STR esx; ///< The decoded message
+} SMART_ESX_EVENT;
+
+/*! \brief Status of the state machine */
+typedef struct SMART_ESX_STATUS {
+  SMART_ESX_STATE state; ///< Current state
+  double since; ///< Time of the transition into the state in [s]
+  double timestamp; ///< Receive timestamp of the last message in [s]
+  unsigned long transitions; ///< Accepted transitions
+  unsigned long invalid; ///< Rejected transitions
+  unsigned long stops; ///< Safe stops triggered
+} SMART_ESX_STATUS;
+
+/*! \brief Transition handler or safe-stop action
+ *
+ * Called from the thread receiving the ESX messages, or calling
+ * smartEsxCheck(). Handlers must not register further handlers.
+ */
+typedef void (*SMART_ESX_HANDLER)(const SMART_ESX_EVENT *event, void *data);
+
+/*!
+ *
+ * \brief Register a handler called on every transition
+ *
+ * Rejected transitions are passed with valid set to EFALSE.
+ *
+ * \return 0 on success, -1 if there are too many handlers
+ *
+ */
+int smartEsxAddHandler(SMART_ESX_HANDLER handler, void *data);
+
+/*!
+ *
+ * \brief Register a safe-stop action
+ *
+ * Actions are called in the order of their registration, before the
+ * transition handlers.
+ *
+ * \return 0 on success, -1 if there are too many actions
+ *
+ */
+int smartEsxAddStopAction(SMART_ESX_HANDLER action, void *data);
+
+/*!
+ *
+ * \brief Status of the state machine
+ *
+ */
+void smartEsxGetStatus(SMART_ESX_STATUS *status);
+
+/*!
+ *
+ * \brief Feed a received ESX message to the state machine
+ *
+ * Called by the ESX message handler.
+ *
+ * \param state The decoded message
+ * \param timestamp Receive timestamp of the message
+ *
+ */
+void smartEsxUpdate(const ESX_STR *state, double timestamp);
+
+/*!
+ *
+ * \brief Check that ESX messages arrive
+ *
+ * Should be called periodically, e.g. by the control cycle. If no message
+ * was received for SMART_ESX_STALE_PERIODS periods while the car was under
+ * control, the safe-stop actions are called and the stop state is
+ * latched. In manual mode, the state becomes unknown.
+ *
+ * \param now The current time of canGetTime()
+ * \return ETRUE if the ESX messages are lost
+ *
+ */
+EBOOL smartEsxCheck(double now);
+
+/*@}*/
+#endif
@@ -11,7 +11,13 @@
 
 #include "smart.h"
 #include "cst.h"
+#include "lss.h"
 #include "handlers.h"
+#include "signals.h"
+#include "notify.h"
+#include "history.h"
+#include "odometry.h"
+#include "esx.h"
 
 /*!
  *  \file vCanMessageHandlers.h
@@ -27,8 +33,45 @@
 SMART_VEHICLE_STATUS smart;
 ESX_STR esx;
 
-unsigned char steer_high,steer_low;
-int steer;
+SMART_SEQLOCK smart_lock = SMART_SEQLOCK_INITIALIZER;
+SMART_SEQLOCK esx_lock = SMART_SEQLOCK_INITIALIZER;
+
+/*! Nominal periods of the messages, indexed by their groups */
+static const double smart_periods[SMART_NUM_GROUPS] = {
+  SMART_SPEED_PERIOD,
+  SMART_ENGINE_PERIOD,
+  SMART_GEAR_PERIOD,
+  SMART_STEERING_PERIOD,
+  SMART_WHEEL_SPEEDS_PERIOD,
+  SMART_ESX_PERIOD,
+};
+
+/*! Updates the freshness of a group of signals on reception of its message.
+Must be called with smart_lock held.
+
+\param group The group of signals
+\param timestamp Receive timestamp of the message
+\return The timestamp
+
+*/
+static double smart_refresh(SMART_MESSAGE_GROUP group, double timestamp)
+{
+  SMART_FRESHNESS *freshness = &smart.freshness[group];
+  double period = timestamp-freshness->timestamp;
+
+  if (freshness->updates && (period > 0.0)) {
+    if (freshness->updates > 1)
+      freshness->period += SMART_FRESHNESS_ALPHA*(period-freshness->period);
+    else
+      freshness->period = period;
+    if (period > SMART_STALE_PERIODS*smart_periods[group])
+      ++freshness->gaps;
+  }
+  freshness->timestamp = timestamp;
+  ++freshness->updates;
+
+  return timestamp;
+}
 
 
 /***************************************************************************
@@ -48,38 +91,69 @@ Message definition:
 
 Output:
 - smart.motion.v_curr - vehicle speed in m/s
+- smart.motion.t_curr - receive timestamp of the vehicle speed
 
 \param handle handle to the can can bus to read from
 \param cpcmsg The message
 
 */
-void get_speed_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+static void speed_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
 {
-  if (cpcmsg->msg.canmsg.id == 0x90)
-    {
-      // EDBG("got speed message\n");
-      smart.status.abs_led_on = ((cpcmsg->msg.canmsg.msg[0])&0x01);
-      smart.status.abs_active = ((cpcmsg->msg.canmsg.msg[0])&0x02);
-      smart.status.esp_led_on = ((cpcmsg->msg.canmsg.msg[0])&0x40);
-      smart.status.esp_led_blink = ((cpcmsg->msg.canmsg.msg[0])&0x80);
-      smart.wheelspeed.front_left_not_plausible = ((cpcmsg->msg.canmsg.msg[4])&0x01);
-      smart.wheelspeed.front_right_not_plausible = ((cpcmsg->msg.canmsg.msg[4])&0x02);
-      smart.wheelspeed.rear_left_not_plausible = ((cpcmsg->msg.canmsg.msg[4])&0x04);
-      smart.wheelspeed.rear_right_not_plausible = ((cpcmsg->msg.canmsg.msg[4])&0x10);
-      smart.status.v_curr = KMH2MS((double) 0.0625*((cpcmsg->msg.canmsg.msg[6]<<8)+cpcmsg->msg.canmsg.msg[5]));
-    }
-  if (cpcmsg->msg.canmsg.id == 0x88)
-    {
-      esx.vehicle_state = cpcmsg->msg.canmsg.msg[0];
-      esx.max_brake_stroke = cpcmsg->msg.canmsg.msg[1];
-      esx.brake_init_started = cpcmsg->msg.canmsg.msg[2];
-      esx.got_first_max_brake = cpcmsg->msg.canmsg.msg[3];
-      esx.request_pause = cpcmsg->msg.canmsg.msg[4];
-      esx.request_stop = cpcmsg->msg.canmsg.msg[5];
-      esx.control_lateral = cpcmsg->msg.canmsg.msg[6];
-      esx.control_longitudinal = cpcmsg->msg.canmsg.msg[7];
- }
+  smartSeqlockWriteBegin(&smart_lock);
+  signals_decode_speed(cpcmsg->msg.canmsg.msg);
+  smart.status.t_curr.tv_sec = cpcmsg->ts_sec;
+  smart.status.t_curr.tv_usec = cpcmsg->ts_nsec/1000;
+  smart.timestamps.speed = smart_refresh(SMART_GROUP_SPEED,
+    canGetTimestamp(cpcmsg));
+  if (smart.freshness[SMART_GROUP_SPEED].period > 0.0)
+    smart.update_rate = 1.0/smart.freshness[SMART_GROUP_SPEED].period;
+  smartSeqlockWriteEnd(&smart_lock);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+}
 
+/*! This handler reads the ESX state message from the CAN Bus
+
+Message definition:
+- ID 0x88
+- Byte 0-7 vehicle state, maximum brake stroke, brake initialization
+  started, got first maximum brake, pause request, stop request,
+  lateral control, longitudinal control
+
+Output:
+- esx - state of the security ECU
+- smart.freshness - freshness of the ESX group
+
+The message is fed to the ESX state machine, which triggers the safe-stop
+actions on stop requests.
+
+\param handle handle to the can can bus to read from
+\param cpcmsg The message
+
+*/
+static void esx_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  ESX_STR state;
+
+  smartSeqlockWriteBegin(&esx_lock);
+  signals_decode_esx(cpcmsg->msg.canmsg.msg);
+  esx.timestamp = canGetTimestamp(cpcmsg);
+  state = esx;
+  smartSeqlockWriteEnd(&esx_lock);
+  smartSeqlockWriteBegin(&smart_lock);
+  smart_refresh(SMART_GROUP_ESX, state.timestamp);
+  smartSeqlockWriteEnd(&smart_lock);
+  smartEsxUpdate(&state, state.timestamp);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+}
+
+void get_speed_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  if (cpcmsg->msg.canmsg.id == SMART_SPEED_CAN_ID)
+    speed_msg_handler(handle, cpcmsg);
+  if (cpcmsg->msg.canmsg.id == SMART_ESX_CAN_ID)
+    esx_msg_handler(handle, cpcmsg);
 }
 
 /*! This handler reads the speed message from the CAN Bus
@@ -104,40 +178,56 @@ Output:
 \param cpcmsg The message
 
 */
+static void engine_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  smartSeqlockWriteBegin(&smart_lock);
+  signals_decode_engine(cpcmsg->msg.canmsg.msg);
+  if (cpcmsg->msg.canmsg.msg[6]&(0x04))
+    smart.status.driving_direction=SMART_FORWARDS;
+  if (cpcmsg->msg.canmsg.msg[6]&(0x10))
+    smart.status.driving_direction=SMART_BACKWARDS;
+  if (cpcmsg->msg.canmsg.msg[6]&(0x20))
+    smart.status.driving_direction=SMART_UNKNOWN;
+  smart.timestamps.engine = smart_refresh(SMART_GROUP_ENGINE,
+    canGetTimestamp(cpcmsg));
+  smartSeqlockWriteEnd(&smart_lock);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+}
+
+/*! This handler reads the engine speed and gear message from the CAN Bus
+
+Message definition:
+- ID 0x300
+- Byte 1 rpm_high
+- Byte 2 rpm_low
+- Byte 3 actual gear (low nibble), target gear (high nibble)
+
+Output:
+- smart.engine.rpm - engine speed in rpm
+- smart.engine.actual_gear, smart.engine.target_gear - gear state
+
+\param handle handle to the can can bus to read from
+\param cpcmsg The message
+
+*/
+static void gear_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  smartSeqlockWriteBegin(&smart_lock);
+  signals_decode_gear(cpcmsg->msg.canmsg.msg);
+  smart.timestamps.gear = smart_refresh(SMART_GROUP_GEAR,
+    canGetTimestamp(cpcmsg));
+  smartSeqlockWriteEnd(&smart_lock);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+}
+
 void get_pedal_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
 {
-  if (cpcmsg->msg.canmsg.id==0x310)
-    {
-      //EDBG("got pedal message\n");
-      smart.engine.drag_torque= (double) cpcmsg->msg.canmsg.msg[0];
-      smart.engine.indicated_torque=(double) cpcmsg->msg.canmsg.msg[1];
-      smart.engine.max_torque=(double) cpcmsg->msg.canmsg.msg[2];
-      smart.engine.min_torque=(double) cpcmsg->msg.canmsg.msg[3];
-      smart.engine.desired_torque=(double) cpcmsg->msg.canmsg.msg[4];
-      smart.status.pedal=(double) (cpcmsg->msg.canmsg.msg[5]/2.5);
-      smart.engine.pedal=(double) (cpcmsg->msg.canmsg.msg[5]/2.5);
-      smart.engine.status=cpcmsg->msg.canmsg.msg[6];
-      if (cpcmsg->msg.canmsg.msg[6]&(0x04))
-	  smart.status.driving_direction=SMART_FORWARDS;
-      if (cpcmsg->msg.canmsg.msg[6]&(0x10))
-	  smart.status.driving_direction=SMART_BACKWARDS;
-      if (cpcmsg->msg.canmsg.msg[6]&(0x20))
-	  smart.status.driving_direction=SMART_UNKNOWN;
-      if (cpcmsg->msg.canmsg.msg[6]&(0x40)) {
-	  smart.status.brake_light_on = ETRUE;
-      }
-      else {
-	  smart.status.brake_light_on = EFALSE;
-      }  
-    }
-
-  if (cpcmsg->msg.canmsg.id==0x300)
-    {
-      smart.engine.rpm = (double) (cpcmsg->msg.canmsg.msg[1]<<8)+cpcmsg->msg.canmsg.msg[2];
-      smart.engine.gear_byte = cpcmsg->msg.canmsg.msg[3];
-      smart.engine.actual_gear = smart.engine.gear_byte & 0x0F;
-      smart.engine.target_gear = smart.engine.gear_byte >> 4;	
-    }
+  if (cpcmsg->msg.canmsg.id == SMART_ENGINE_CAN_ID)
+    engine_msg_handler(handle, cpcmsg);
+  if (cpcmsg->msg.canmsg.id == SMART_GEAR_CAN_ID)
+    gear_msg_handler(handle, cpcmsg);
 }
 
 /*! This handler reads the steering angle message from the CAN Bus
@@ -158,25 +248,22 @@ Output:
 \param cpcmsg The message
 
 */
-void get_steering_msg_handler(int handle, const CPC_MSG_T * cpcmsg){ 
-  if (cpcmsg->msg.canmsg.id == 2+12*16)
-    {
-      steer_high=cpcmsg->msg.canmsg.msg[1];
-      steer_low=cpcmsg->msg.canmsg.msg[0];
-      steer=0;
-      if (steer_high<128)//bit one in high bite codes sign
-	{
-	  /*turn left: positive*/ 
-	  steer= (steer_high<<8)+steer_low;
-	}
-      else
-	{
-	  /*turn right*/ 
-	  steer=((128-steer_high)<<8)+steer_low;
-	}
-      smart.status.phi_curr = DEG2RAD((double) 0.04375*steer ) / STEERING_FACTOR;
-      //EDBG("Got steering of %f\n",smart.status.phi_curr);
-    }
+static void steering_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  smartSeqlockWriteBegin(&smart_lock);
+  signals_decode_steering(cpcmsg->msg.canmsg.msg);
+  smart.timestamps.steering = smart_refresh(SMART_GROUP_STEERING,
+    canGetTimestamp(cpcmsg));
+  smartSeqlockWriteEnd(&smart_lock);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+  //EDBG("Got steering of %f\n",smart.status.phi_curr);
+}
+
+void get_steering_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
+{
+  if (cpcmsg->msg.canmsg.id == SMART_STEERING_CAN_ID)
+    steering_msg_handler(handle, cpcmsg);
 }
 
 /* This handler reads the wheel speeds from the CAN Bus
@@ -205,28 +292,73 @@ Output:
 \param cpcmsg The message
 
 */
+static void wheel_speeds_msg_handler(int handle, const CPC_MSG_T *cpcmsg)
+{
+  smartSeqlockWriteBegin(&smart_lock);
+  signals_decode_wheelspeed(cpcmsg->msg.canmsg.msg);
+  smart.timestamps.wheelspeed = smart_refresh(SMART_GROUP_WHEELSPEED,
+    canGetTimestamp(cpcmsg));
+  smartOdometryUpdate(&smart, smart.timestamps.wheelspeed);
+  smartSeqlockWriteEnd(&smart_lock);
+  smartHistoryRecord(cpcmsg);
+  smartNotify(cpcmsg);
+}
+
 void get_wheel_speeds_msg_handler(int handle, const CPC_MSG_T *cpcmsg)
 {
-  if (cpcmsg->msg.canmsg.id == 0x80)
-    {
-      smart.wheelspeed.front_right = 
-	(double) (((cpcmsg->msg.canmsg.msg[0]<<8) 
-		   + cpcmsg->msg.canmsg.msg[1])/(2.0*60.0));
-      smart.wheelspeed.front_left  = 
-	(double) (((cpcmsg->msg.canmsg.msg[2]<<8) 
-		   + cpcmsg->msg.canmsg.msg[3])/(2.0*60.0));
-      smart.wheelspeed.rear_right = 
-	(double) (((cpcmsg->msg.canmsg.msg[4]<<8) + 
-		   cpcmsg->msg.canmsg.msg[5])/(2.0*60.0));
-      smart.wheelspeed.rear_left = 
-	(double) (((cpcmsg->msg.canmsg.msg[6]<<8) 
-		   + cpcmsg->msg.canmsg.msg[7])/(2.0*60.0));
-    }
+  if (cpcmsg->msg.canmsg.id == SMART_WHEEL_SPEEDS_CAN_ID)
+    wheel_speeds_msg_handler(handle, cpcmsg);
 }
 
 
+void smartGetStatus(SMART_VEHICLE_STATUS *status)
+{
+  smartSeqlockRead(&smart_lock, status, &smart, sizeof(smart));
+}
+
+void smartGetEsx(ESX_STR *state)
+{
+  smartSeqlockRead(&esx_lock, state, &esx, sizeof(esx));
+}
+
+EBOOL smartIsStale(const SMART_VEHICLE_STATUS *status,
+  SMART_MESSAGE_GROUP group, double now)
+{
+  return !status->freshness[group].updates ||
+    (now-status->freshness[group].timestamp >
+      SMART_STALE_PERIODS*smart_periods[group]);
+}
+
+int smartGetStaleGroups(const SMART_VEHICLE_STATUS *status, double now)
+{
+  int group, stale = 0;
+
+  for (group = 0; group < SMART_NUM_GROUPS; ++group)
+    if (smartIsStale(status, group, now))
+      stale |= 1 << group;
+
+  return stale;
+}
+
 void get_esx_mesage_handler(int handle, const CPC_MSG_T *cpcmsg)
 {
 }
 
+/*! Registers the message handlers with the dispatcher of a CAN bus, such
+that each of them only gets called for the message ID it decodes.
+
+\param busId CAN bus to register the handlers for
+
+*/
+void register_msg_handlers(int busId)
+{
+  canAddIdHandler(busId, SMART_SPEED_CAN_ID, speed_msg_handler);
+  canAddIdHandler(busId, SMART_ESX_CAN_ID, esx_msg_handler);
+  canAddIdHandler(busId, SMART_ENGINE_CAN_ID, engine_msg_handler);
+  canAddIdHandler(busId, SMART_GEAR_CAN_ID, gear_msg_handler);
+  canAddIdHandler(busId, SMART_STEERING_CAN_ID, steering_msg_handler);
+  canAddIdHandler(busId, SMART_WHEEL_SPEEDS_CAN_ID, wheel_speeds_msg_handler);
+  canAddIdHandler(busId, LSS_REPLY_CAN_ID, lss_get_msg_handler);
+}
+
 /*@}*/
@@ -21,10 +21,79 @@
 
 #include "smart.h"
 #include "can.h"
+#include "seqlock.h"
+
+/*! \brief CAN ID of the speed and ABS message */
+#define SMART_SPEED_CAN_ID (0x90)
+/*! \brief CAN ID of the ESX state message */
+#define SMART_ESX_CAN_ID (0x88)
+/*! \brief CAN ID of the engine torque and pedal message */
+#define SMART_ENGINE_CAN_ID (0x310)
+/*! \brief CAN ID of the engine speed and gear message */
+#define SMART_GEAR_CAN_ID (0x300)
+/*! \brief CAN ID of the steering angle message */
+#define SMART_STEERING_CAN_ID (0xc2)
+/*! \brief CAN ID of the wheel speeds message */
+#define SMART_WHEEL_SPEEDS_CAN_ID (0x80)
+
+/*! \brief Nominal period of the speed message in [s] */
+#define SMART_SPEED_PERIOD 0.01
+/*! \brief Nominal period of the engine message in [s] */
+#define SMART_ENGINE_PERIOD 0.01
+/*! \brief Nominal period of the gear message in [s] */
+#define SMART_GEAR_PERIOD 0.01
+/*! \brief Nominal period of the steering angle message in [s] */
+#define SMART_STEERING_PERIOD 0.02
+/*! \brief Nominal period of the wheel speeds message in [s] */
+#define SMART_WHEEL_SPEEDS_PERIOD 0.02
 
 extern SMART_VEHICLE_STATUS smart;
 extern ESX_STR esx;
 
+/*! \brief Sequence lock of smart, held by the handlers while decoding
+ *
+ * Other writers of smart must update it between smartSeqlockWriteBegin()
+ * and smartSeqlockWriteEnd() as well.
+ */
+extern SMART_SEQLOCK smart_lock;
+/*! \brief Sequence lock of esx, held by the handlers while decoding */
+extern SMART_SEQLOCK esx_lock;
+
+/*! \brief Consistent copy of the vehicle status
+ *
+ * The copy never mixes the signals of different messages of the same
+ * type, e.g. the speed of one speed message with the ABS flags of
+ * another. The caller does not lock and never delays the CAN threads.
+ *
+ * \param status Destination of the copy
+ */
+void smartGetStatus(SMART_VEHICLE_STATUS *status);
+
+/*! \brief Check if a group of signals is stale
+ *
+ * A group is stale if it was never updated or its last update is older
+ * than SMART_STALE_PERIODS nominal periods of its message.
+ *
+ * \param status The vehicle status, e.g. a copy from smartGetStatus()
+ * \param group The group of signals
+ * \param now The current time of canGetTime()
+ * \return ETRUE if the group is stale
+ */
+EBOOL smartIsStale(const SMART_VEHICLE_STATUS *status,
+  SMART_MESSAGE_GROUP group, double now);
+
+/*! \brief Check all groups of signals for staleness, see smartIsStale()
+ *
+ * \return Mask of the stale groups, bit n for group n
+ */
+int smartGetStaleGroups(const SMART_VEHICLE_STATUS *status, double now);
+
+/*! \brief Consistent copy of the ESX state, see smartGetStatus()
+ *
+ * \param state Destination of the copy
+ */
+void smartGetEsx(ESX_STR *state);
+
 void get_speed_msg_handler(int handle, const CPC_MSG_T * cpcmsg);
 
 void get_pedal_msg_handler(int handle, const CPC_MSG_T * cpcmsg);
@@ -35,5 +104,11 @@ void get_steering_msg_handler(int handle, const CPC_MSG_T * cpcmsg);
 
 void get_wheel_speeds_msg_handler(int handle, const CPC_MSG_T *cpcmsg);
 
+/*! \brief Registers the VCAN and LSS message handlers for their message IDs
+ *
+ * \param busId CAN bus to register the handlers for
+ */
+void register_msg_handlers(int busId);
+
 /*@}*/
 #endif
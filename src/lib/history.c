@@ -0,0 +1,325 @@
+/*!
+ *  \file history.c
+ *
+ *  \brief Fixed-memory history of the signals received from the car
+ *
+ * Samples are numbered by the count of samples recorded before them and
+ * stored in the slot of their number modulo SMART_HISTORY_SIZE. The leaf
+ * of a slot in the segment trees is the slot plus SMART_HISTORY_SIZE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <libelrob/Edebug.h>
+
+#include "history.h"
+
+#define HISTORY_MASK (SMART_HISTORY_SIZE-1)
+
+/*! \brief History of a signal */
+typedef struct SMART_HISTORY {
+  SMART_SEQLOCK lock; ///< Protects the history against the reader
+  int signal; ///< The signal
+  int can_id; ///< CAN ID of the message
+  unsigned long count; ///< Number of samples recorded
+  double timestamps[SMART_HISTORY_SIZE]; ///< Timestamps of the samples
+  double values[SMART_HISTORY_SIZE]; ///< Values of the samples
+  double sums[SMART_HISTORY_SIZE]; ///< Sums of all values up to the sample
+  double min[2*SMART_HISTORY_SIZE]; ///< Segment tree of the minima
+  double max[2*SMART_HISTORY_SIZE]; ///< Segment tree of the maxima
+} SMART_HISTORY;
+
+static SMART_HISTORY history_signals[SMART_HISTORY_MAX_SIGNALS];
+static int history_num_signals = 0;
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*! History per signal, 0 if the signal has none */
+static SMART_HISTORY *history_index[SMART_NUM_SIGNALS];
+/*! Number of signals with a history per CAN ID */
+static unsigned char history_counts[LIBCAN_NUM_IDS];
+
+/*!
+ *
+ * \brief adds a sample to a history
+ *
+ * Must be called with the history's lock held.
+ *
+ */
+static void history_add(SMART_HISTORY *history, double timestamp,
+  double value)
+{
+  int slot = history->count & HISTORY_MASK, node;
+  double sum = history->count ?
+    history->sums[(history->count-1) & HISTORY_MASK] : 0.0;
+
+  history->timestamps[slot] = timestamp;
+  history->values[slot] = value;
+  history->sums[slot] = sum+value;
+
+  node = slot+SMART_HISTORY_SIZE;
+  history->min[node] = history->max[node] = value;
+  for (node >>= 1; node; node >>= 1) {
+    history->min[node] = fmin(history->min[2*node], history->min[2*node+1]);
+    history->max[node] = fmax(history->max[2*node], history->max[2*node+1]);
+  }
+
+  ++history->count;
+}
+
+/*!
+ *
+ * \brief first sample not before a time
+ *
+ * \return The number of the sample, history->count if there is none
+ *
+ */
+static unsigned long history_find(const SMART_HISTORY *history,
+  unsigned long count, double timestamp)
+{
+  unsigned long first = (count > SMART_HISTORY_SIZE) ?
+    count-SMART_HISTORY_SIZE : 0, last = count, middle;
+
+  while (first < last) {
+    middle = first+(last-first)/2;
+    if (history->timestamps[middle & HISTORY_MASK] < timestamp)
+      first = middle+1;
+    else
+      last = middle;
+  }
+
+  return first;
+}
+
+/*!
+ *
+ * \brief extends the minimum and maximum by the slots in [first, last]
+ *
+ */
+static void history_range(const SMART_HISTORY *history, int first, int last,
+  double *min, double *max)
+{
+  first += SMART_HISTORY_SIZE;
+  last += SMART_HISTORY_SIZE+1;
+
+  for (; first < last; first >>= 1, last >>= 1) {
+    if (first & 1) {
+      *min = fmin(*min, history->min[first]);
+      *max = fmax(*max, history->max[first]);
+      ++first;
+    }
+    if (last & 1) {
+      --last;
+      *min = fmin(*min, history->min[last]);
+      *max = fmax(*max, history->max[last]);
+    }
+  }
+}
+
+/*!
+ *
+ * \brief statistics of the samples [first, last)
+ *
+ */
+static void history_stats(const SMART_HISTORY *history, unsigned long first,
+  unsigned long last, SMART_HISTORY_STATS *stats)
+{
+  int first_slot = first & HISTORY_MASK, last_slot = (last-1) & HISTORY_MASK;
+
+  stats->count = last-first;
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+  if (!stats->count) {
+    stats->mean = stats->min = stats->max = NAN;
+    return;
+  }
+
+  stats->mean = (history->sums[last_slot]-history->sums[first_slot]+
+    history->values[first_slot])/stats->count;
+  if (first_slot <= last_slot)
+    history_range(history, first_slot, last_slot, &stats->min, &stats->max);
+  else {
+    history_range(history, first_slot, HISTORY_MASK, &stats->min,
+      &stats->max);
+    history_range(history, 0, last_slot, &stats->min, &stats->max);
+  }
+}
+
+int smartHistoryEnable(SMART_SIGNAL_ID signal)
+{
+  SMART_HISTORY *history = 0;
+  int i;
+
+  if ((signal < 0) || (signal >= SMART_NUM_SIGNALS))
+    return -1;
+
+  pthread_mutex_lock(&history_mutex);
+  if (!history_index[signal] &&
+      (history_num_signals < SMART_HISTORY_MAX_SIGNALS)) {
+    history = &history_signals[history_num_signals++];
+    memset(history, 0, sizeof(SMART_HISTORY));
+    pthread_mutex_init(&history->lock.mutex, 0);
+    history->signal = signal;
+    history->can_id = smart_signals[signal].can_id;
+    for (i = 0; i < 2*SMART_HISTORY_SIZE; ++i) {
+      history->min[i] = INFINITY;
+      history->max[i] = -INFINITY;
+    }
+    __atomic_store_n(&history_index[signal], history, __ATOMIC_RELEASE);
+    __atomic_store_n(&history_counts[history->can_id],
+      history_counts[history->can_id]+1, __ATOMIC_RELEASE);
+  }
+  else if (history_index[signal])
+    history = history_index[signal];
+  pthread_mutex_unlock(&history_mutex);
+
+  if (!history) {
+    EDBG("ERROR: too many signals with a history\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int smartHistoryEnableDefaults(void)
+{
+  static const SMART_SIGNAL_ID signals[] = {
+    SMART_SIGNAL_speed_v_curr,
+    SMART_SIGNAL_steering_phi_curr,
+    SMART_SIGNAL_gear_rpm,
+    SMART_SIGNAL_wheelspeed_front_right,
+    SMART_SIGNAL_wheelspeed_front_left,
+    SMART_SIGNAL_wheelspeed_rear_right,
+    SMART_SIGNAL_wheelspeed_rear_left,
+    SMART_SIGNAL_engine_pedal,
+  };
+  int i, result = 0;
+
+  for (i = 0; i < sizeof(signals)/sizeof(SMART_SIGNAL_ID); ++i)
+    result |= smartHistoryEnable(signals[i]);
+
+  return result;
+}
+
+void smartHistoryRecord(const CPC_MSG_T *cpcmsg)
+{
+  SMART_HISTORY *history;
+  int can_id = cpcmsg->msg.canmsg.id, signal;
+  double values[SMART_NUM_SIGNALS], timestamp;
+
+  if ((can_id < 0) || (can_id >= LIBCAN_NUM_IDS) ||
+      !__atomic_load_n(&history_counts[can_id], __ATOMIC_ACQUIRE))
+    return;
+
+  if (!smartSignalsDecodeMessage(cpcmsg, values))
+    return;
+  timestamp = canGetTimestamp(cpcmsg);
+
+  for (signal = 0; signal < SMART_NUM_SIGNALS; ++signal) {
+    history = __atomic_load_n(&history_index[signal], __ATOMIC_ACQUIRE);
+    if (!history || (history->can_id != can_id))
+      continue;
+
+    smartSeqlockWriteBegin(&history->lock);
+    if (!history->count ||
+        (history->timestamps[(history->count-1) & HISTORY_MASK] <= timestamp))
+      history_add(history, timestamp, values[signal]);
+    smartSeqlockWriteEnd(&history->lock);
+  }
+}
+
+int smartHistoryGetSamples(SMART_SIGNAL_ID signal, double t0, double t1,
+  SMART_HISTORY_SAMPLE *samples, int max_samples)
+{
+  const SMART_HISTORY *history;
+  unsigned long count, first, last, i;
+  unsigned int sequence;
+  int num_samples;
+
+  if ((signal < 0) || (signal >= SMART_NUM_SIGNALS) ||
+      !(history = __atomic_load_n(&history_index[signal], __ATOMIC_ACQUIRE)))
+    return -1;
+
+  do {
+    sequence = smartSeqlockReadBegin(&history->lock);
+    count = history->count;
+    first = history_find(history, count, t0);
+    last = history_find(history, count, nextafter(t1, INFINITY));
+    if (last < first)
+      last = first;
+    if (last-first > (unsigned long)max_samples)
+      first = last-max_samples;
+
+    num_samples = 0;
+    for (i = first; i < last; ++i, ++num_samples) {
+      samples[num_samples].timestamp = history->timestamps[i & HISTORY_MASK];
+      samples[num_samples].value = history->values[i & HISTORY_MASK];
+    }
+  }
+  while (smartSeqlockReadRetry(&history->lock, sequence));
+
+  return num_samples;
+}
+
+int smartHistoryGetStats(SMART_SIGNAL_ID signal, double t0, double t1,
+  SMART_HISTORY_STATS *stats)
+{
+  const SMART_HISTORY *history;
+  unsigned long count, first, last;
+  unsigned int sequence;
+
+  if ((signal < 0) || (signal >= SMART_NUM_SIGNALS) ||
+      !(history = __atomic_load_n(&history_index[signal], __ATOMIC_ACQUIRE)))
+    return -1;
+
+  do {
+    sequence = smartSeqlockReadBegin(&history->lock);
+    count = history->count;
+    first = history_find(history, count, t0);
+    last = history_find(history, count, nextafter(t1, INFINITY));
+    history_stats(history, first, (last > first) ? last : first, stats);
+  }
+  while (smartSeqlockReadRetry(&history->lock, sequence));
+
+  return 0;
+}
+
+int smartHistoryInterpolate(SMART_SIGNAL_ID signal, double timestamp,
+  double *value)
+{
+  const SMART_HISTORY *history;
+  unsigned long count, oldest, next;
+  unsigned int sequence;
+  double t0, t1, v0, v1;
+  int result;
+
+  if ((signal < 0) || (signal >= SMART_NUM_SIGNALS) ||
+      !(history = __atomic_load_n(&history_index[signal], __ATOMIC_ACQUIRE)))
+    return -1;
+
+  do {
+    sequence = smartSeqlockReadBegin(&history->lock);
+    count = history->count;
+    oldest = (count > SMART_HISTORY_SIZE) ? count-SMART_HISTORY_SIZE : 0;
+    next = history_find(history, count, timestamp);
+    result = -1;
+
+    if (next < count) {
+      t1 = history->timestamps[next & HISTORY_MASK];
+      v1 = history->values[next & HISTORY_MASK];
+      if (t1 == timestamp) {
+        *value = v1;
+        result = 0;
+      }
+      else if (next > oldest) {
+        t0 = history->timestamps[(next-1) & HISTORY_MASK];
+        v0 = history->values[(next-1) & HISTORY_MASK];
+        *value = v0+(v1-v0)*(timestamp-t0)/(t1-t0);
+        result = 0;
+      }
+    }
+  }
+  while (smartSeqlockReadRetry(&history->lock, sequence));
+
+  return result;
+}
@@ -0,0 +1,125 @@
+#ifndef SMART_HISTORY_H
+#define SMART_HISTORY_H
+
+#include <libcpc/cpclib.h>
+#include <libelrob/Etypes.h>
+
+#include "signals.h"
+#include "seqlock.h"
+
+/*! \defgroup smartlibhistory Time-series history of decoded signals
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file history.h
+ *
+ *  \brief Fixed-memory history of the signals received from the car
+ *
+ * The history of a signal is a ring of its last SMART_HISTORY_SIZE
+ * samples at the rate of its message, stored as separate arrays of
+ * timestamps, values and running sums, together with segment trees of the
+ * minima and maxima. Since the timestamps of a signal never decrease,
+ * samples in a time interval are found by bisection, and their mean,
+ * minimum and maximum are computed in O(log n).
+ *
+ * The message handlers record the samples, while other threads query
+ * the history without locking, see seqlock.h.
+ */
+
+/*! \brief Number of samples per signal, must be a power of 2 */
+#define SMART_HISTORY_SIZE 2048
+/*! \brief Maximum number of signals with a history */
+#define SMART_HISTORY_MAX_SIGNALS 12
+
+/*! \brief Sample of a signal */
+typedef struct SMART_HISTORY_SAMPLE {
+  double timestamp; ///< Receive timestamp in [s]
+  double value; ///< Value
+} SMART_HISTORY_SAMPLE;
+
+/*! \brief Statistics of a signal over a time interval */
+typedef struct SMART_HISTORY_STATS {
+  int count; ///< Number of samples
+  double mean; ///< Mean value
+  double min; ///< Minimum value
+  double max; ///< Maximum value
+} SMART_HISTORY_STATS;
+
+/*!
+ *
+ * \brief Record the history of a signal
+ *
+ * \param signal The signal
+ * \return 0 on success, -1 if there are too many signals with a history
+ *
+ */
+int smartHistoryEnable(SMART_SIGNAL_ID signal);
+
+/*!
+ *
+ * \brief Record the history of v_curr, phi_curr, rpm, wheel speeds and pedal
+ *
+ * \return 0 on success, -1 on failure
+ *
+ */
+int smartHistoryEnableDefaults(void);
+
+/*!
+ *
+ * \brief Record the signals of a received message
+ *
+ * Called by the message handlers. Samples older than the last sample of
+ * their signal are discarded.
+ *
+ */
+void smartHistoryRecord(const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief Samples of a signal in a time interval
+ *
+ * \param signal The signal
+ * \param t0 Start of the interval in [s]
+ * \param t1 End of the interval in [s]
+ * \param samples Destination of the samples, in chronological order
+ * \param max_samples Maximum number of samples, the latest are returned
+ * \return The number of samples or -1 if the signal has no history
+ *
+ */
+int smartHistoryGetSamples(SMART_SIGNAL_ID signal, double t0, double t1,
+  SMART_HISTORY_SAMPLE *samples, int max_samples);
+
+/*!
+ *
+ * \brief Mean, minimum and maximum of a signal in a time interval
+ *
+ * For the statistics over the last N seconds, pass canGetTime()-N as t0.
+ *
+ * \param signal The signal
+ * \param t0 Start of the interval in [s]
+ * \param t1 End of the interval in [s]
+ * \param stats The statistics, count is 0 if there are no samples
+ * \return 0 on success, -1 if the signal has no history
+ *
+ */
+int smartHistoryGetStats(SMART_SIGNAL_ID signal, double t0, double t1,
+  SMART_HISTORY_STATS *stats);
+
+/*!
+ *
+ * \brief Value of a signal linearly interpolated at a time
+ *
+ * \param signal The signal
+ * \param timestamp The time in [s]
+ * \param value The interpolated value
+ * \return 0 on success, -1 if the time is outside the recorded samples
+ *
+ */
+int smartHistoryInterpolate(SMART_SIGNAL_ID signal, double timestamp,
+  double *value);
+
+/*@}*/
+#endif
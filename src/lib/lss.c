@@ -7,8 +7,12 @@
 
 #include "lss.h"
 #include "can.h"
+#include "signals.h"
+#include "notify.h"
+#include "history.h"
 
 LSS_STR lss;
+SMART_SEQLOCK lss_lock = SMART_SEQLOCK_INITIALIZER;
 
 void lss_init(int bus_id)
 {
@@ -35,24 +39,19 @@ int lss_save_position_limits(int bus_id, double min_position, double max_positio
 {
   // max position = 75mm and min position = 0mm
   if (min_position >= LSS_MIN_POSITION && max_position <= LSS_MAX_POSITION){
-    if (    
+    LSS_REQUEST requests[] = {
       // Change pointer to Software stroke limit positive end (LIMM) adress
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007802, ETRUE) &&
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007802, EFALSE) &&
-  
+      {LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007802},
       // Write LIMM
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_WRITE_DATA_TO_MEM, LSS_MM_TO_INC(max_position), ETRUE) &&
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_WRITE_DATA_TO_MEM, LSS_MM_TO_INC(max_position), EFALSE) &&
-  
+      {LSS_NO_ATTRIBUTE, LSS_WRITE_DATA_TO_MEM, LSS_MM_TO_INC(max_position)},
       // Change pointer to Software stroke limit negative end (LIML)
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007803, ETRUE) &&
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007803, EFALSE) &&
-  
+      {LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, (int)0x00007803},
       // Write LIML
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, LSS_MM_TO_INC(min_position), ETRUE) &&
-      !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, LSS_MM_TO_INC(min_position), EFALSE)
-    )
-    return 0;
+      {LSS_NO_ATTRIBUTE, LSS_DEST_ADDR_DATA_WRITE, LSS_MM_TO_INC(min_position)},
+    };
+
+    if (!lss_send_requests(bus_id, requests, sizeof(requests)/sizeof(LSS_REQUEST)))
+      return 0;
   }
   else {
     EDBG("Error: out of limit (0, 75), no change apply");
@@ -61,32 +60,70 @@ int lss_save_position_limits(int bus_id, double min_position, double max_positio
   return -1;
 }
 
+/*!
+ *
+ * \brief fills a CAN message with an LSS request
+ *
+ */
+static void lss_fill_request(CPC_CAN_MSG_T *cmsg, int get_attribute_id,
+  int set_attribute_id, int set_value, EBOOL load_data)
+{
+  cmsg->id = LSS_CAN_ID;
+  cmsg->length = 8;
+  cmsg->msg[0]= LSS_DATA_HEADER + load_data;
+  cmsg->msg[1]= get_attribute_id;
+  cmsg->msg[2]= LSS_COMMAND_MSG_TYPE;
+  cmsg->msg[3]= set_attribute_id;
+  cmsg->msg[4]= (char)(set_value & 0x000000FF);
+  cmsg->msg[5]= (char)((set_value & 0x0000FF00) >> 8);
+  cmsg->msg[6]= (char)((set_value & 0x00FF0000) >> 16);
+  cmsg->msg[7]= (char)((set_value & 0xFF000000) >> 24);
+}
+
 int lss_send_request(int bus_id, int get_attribute_id, int set_attribute_id, int set_value, EBOOL load_data) 
 {
   int result;
-  char msg[8];
+  CPC_CAN_MSG_T cmsg;
 
-  msg[0]= LSS_DATA_HEADER + load_data;
-  msg[1]= get_attribute_id;
-  msg[2]= LSS_COMMAND_MSG_TYPE;
-  msg[3]= set_attribute_id;
-  msg[4]= (char)(set_value & 0x000000FF);
-  msg[5]= (char)((set_value & 0x0000FF00) >> 8);
-  msg[6]= (char)((set_value & 0x00FF0000) >> 16);
-  msg[7]= (char)((set_value & 0xFF000000) >> 24);
+  lss_fill_request(&cmsg, get_attribute_id, set_attribute_id, set_value,
+    load_data);
 
-  if ((result = my_send_can_message(bus_id, LSS_CAN_ID, msg)))
+  if ((result = my_send_can_message(bus_id, LSS_CAN_ID, (char*)cmsg.msg)))
     usleep(10000);
 
   return result;
 }
 
+int lss_send_requests(int bus_id, const LSS_REQUEST *requests, int count)
+{
+  CPC_CAN_MSG_T cmsgs[2*LSS_MAX_REQUESTS];
+  int status[2*LSS_MAX_REQUESTS];
+  int i;
+
+  if (count > LSS_MAX_REQUESTS)
+    return -1;
+
+  /* Each request is loaded first and then confirmed with the same data */
+  for (i = 0; i < count; ++i) {
+    lss_fill_request(&cmsgs[2*i], requests[i].get_attribute_id,
+      requests[i].set_attribute_id, requests[i].set_value, ETRUE);
+    lss_fill_request(&cmsgs[2*i+1], requests[i].get_attribute_id,
+      requests[i].set_attribute_id, requests[i].set_value, EFALSE);
+  }
+
+  return (canHWSendBatch(bus_id, cmsgs, 2*count, status) == 2*count) ? 0 : -1;
+}
+
+int lss_send_request_pair(int bus_id, int get_attribute_id, int set_attribute_id, int set_value)
+{
+  LSS_REQUEST request = {get_attribute_id, set_attribute_id, set_value};
+
+  return lss_send_requests(bus_id, &request, 1);
+}
+
 int lss_test_stroke_max(int bus_id)
 {
-  if (
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MAX_HOMING, ETRUE) &&
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MAX_HOMING, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MAX_HOMING))
     return 0;
   else
     return -1;
@@ -95,10 +132,7 @@ int lss_test_stroke_max(int bus_id)
 
 int lss_test_stroke_min(int bus_id)
 {
-  if (
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MIN_HOMING, ETRUE) &&
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MIN_HOMING, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_NO_ATTRIBUTE, LSS_EXEC_HOMING, LSS_MIN_HOMING))
     return 0;
   else
     return -1;
@@ -109,30 +143,21 @@ int lss_set_position(int bus_id, double position)
   position = (position < LSS_MIN_POSITION) ? LSS_MIN_POSITION : position;
   position = (position > LSS_MAX_POSITION) ? LSS_MAX_POSITION : position;
 
-  if (
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_TARGET_POSITION, LSS_MM_TO_INC(position), ETRUE) &&
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_TARGET_POSITION, LSS_MM_TO_INC(position), EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_NO_ATTRIBUTE, LSS_TARGET_POSITION, LSS_MM_TO_INC(position)))
     return 0;
   else
     return -1;
 }
 
 int lss_get_commanded_position(int bus_id) {
-  if (
-    !lss_send_request(bus_id, LSS_TARGET_POSITION, LSS_NO_ATTRIBUTE, 0, ETRUE) &&
-    !lss_send_request(bus_id, LSS_TARGET_POSITION, LSS_NO_ATTRIBUTE, 0, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_TARGET_POSITION, LSS_NO_ATTRIBUTE, 0))
     return 0;
   else
     return -1;
 }
 
 int lss_get_actual_position (int bus_id){
-  if (
-    !lss_send_request(bus_id, LSS_ACTUAL_POSITION, LSS_NO_ATTRIBUTE, 0, ETRUE) &&
-    !lss_send_request(bus_id, LSS_ACTUAL_POSITION, LSS_NO_ATTRIBUTE, 0, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_ACTUAL_POSITION, LSS_NO_ATTRIBUTE, 0))
     return 0;
   else
     return -1;
@@ -140,12 +165,8 @@ int lss_get_actual_position (int bus_id){
 
 int lss_set_max_drive_current(int bus_id, double moving, double holding){
   if (moving >= 0 && moving <= 1 && holding >= 0 && holding <= 1){
-    if (
-      !lss_send_request(bus_id, LSS_ACTUAL_POSITION, LSS_DRIVE_CURRENT, 
-        ((int)(LSS_MAX_HOLDING_CURRENT*holding)<<16) + (int)(LSS_MAX_MOVING_CURRENT*moving), ETRUE) &&
-      !lss_send_request(bus_id, LSS_ACTUAL_POSITION, LSS_DRIVE_CURRENT, 
-		     ((int)(LSS_MAX_HOLDING_CURRENT*holding)<<16) + (int)(LSS_MAX_MOVING_CURRENT*moving), EFALSE)
-    )
+    if (!lss_send_request_pair(bus_id, LSS_ACTUAL_POSITION, LSS_DRIVE_CURRENT, 
+        ((int)(LSS_MAX_HOLDING_CURRENT*holding)<<16) + (int)(LSS_MAX_MOVING_CURRENT*moving)))
       return 0;
   }
   else {
@@ -156,30 +177,21 @@ int lss_set_max_drive_current(int bus_id, double moving, double holding){
 }
 
 int lss_get_max_drive_current(int bus_id){
-  if (
-    !lss_send_request(bus_id, LSS_DRIVE_CURRENT, LSS_NO_ATTRIBUTE, 0, ETRUE) &&
-    !lss_send_request(bus_id, LSS_DRIVE_CURRENT, LSS_NO_ATTRIBUTE, 0, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_DRIVE_CURRENT, LSS_NO_ATTRIBUTE, 0))
     return 0;
   else
     return -1;
 }
 
 int lss_set_brake_hold(int bus_id){
-  if (
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_HOLD, ETRUE) &&
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_HOLD, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_HOLD))
     return 0;
   else
     return -1;
 }
 
 int lss_set_brake_release(int bus_id){
-  if (
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_RELEASE, ETRUE) &&
-    !lss_send_request(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_RELEASE, EFALSE)
-  )
+  if (!lss_send_request_pair(bus_id, LSS_NO_ATTRIBUTE, LSS_BRAKE_CONTROL, LSS_BRAKE_RELEASE))
     return 0;
   else
     return -1;
@@ -193,23 +205,14 @@ void lss_get_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
 {
   //EDBG("iCan activity detected...");
   
-  if (cpcmsg->msg.canmsg.id == 0x1bf) {
+  if (cpcmsg->msg.canmsg.id == LSS_REPLY_CAN_ID) {
     //EDBG("... it's a brake motor message");
 
+    smartSeqlockWriteBegin(&lss_lock);
+
     // Store motor state
-    lss.enable_moving =        (cpcmsg->msg.canmsg.msg[0] & 0x80) >> 7;
-    lss.homing_done =          (cpcmsg->msg.canmsg.msg[0] & 0x20) >> 5;
-    lss.shaft_moving_up =      (cpcmsg->msg.canmsg.msg[0] & 0x10) >> 4;
-    lss.general_error =        (cpcmsg->msg.canmsg.msg[0] & 0x08) >> 3;
-    lss.on_target_position =   (cpcmsg->msg.canmsg.msg[0] & 0x04) >> 2;
-    lss.motor_moving =         (cpcmsg->msg.canmsg.msg[0] & 0x01);
-    lss.command_loaded =       (cpcmsg->msg.canmsg.msg[2] & 0x80) >> 7;
-    lss.error.following =      (cpcmsg->msg.canmsg.msg[2] & 0x20) >> 5;
-    lss.error.negative_limit = (cpcmsg->msg.canmsg.msg[2] & 0x10) >> 4;
-    lss.error.positive_limit = (cpcmsg->msg.canmsg.msg[2] & 0x08) >> 3;
-    lss.error.stroke_reverse = (cpcmsg->msg.canmsg.msg[2] & 0x04) >> 2;
-    lss.error.stroke_foward =  (cpcmsg->msg.canmsg.msg[2] & 0x02) >> 1;
-    lss.error.input =          (cpcmsg->msg.canmsg.msg[2] & 0x01);
+    signals_decode_lss(cpcmsg->msg.canmsg.msg);
+    lss.timestamp = canGetTimestamp(cpcmsg);
 
     switch(cpcmsg->msg.canmsg.msg[1]){
 
@@ -247,6 +250,15 @@ void lss_get_msg_handler(int handle, const CPC_MSG_T * cpcmsg)
       ;
       //EDBG("LSS message unhandled");
     }
+
+    smartSeqlockWriteEnd(&lss_lock);
+    smartHistoryRecord(cpcmsg);
+    smartNotify(cpcmsg);
   }  
 }
+
+void lss_get_state(LSS_STR *state)
+{
+  smartSeqlockRead(&lss_lock, state, &lss, sizeof(lss));
+}
   
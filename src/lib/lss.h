@@ -5,8 +5,12 @@
 
 #include <libelrob/Etypes.h>
 
+#include "seqlock.h"
+
 //
 #define LSS_CAN_ID (0x23f)
+// CAN ID of the LSS replies
+#define LSS_REPLY_CAN_ID (0x1bf)
 
 // Headers [bit0,   bit1, bit2     , bit3       , bit4     , bit5       , bit6, bit7                   ] 
 //         [Enable, 0   , Hard Stop, Smooth Stop, Direction, Incremental, 0   , Load Data/Start Profile]
@@ -96,14 +100,34 @@ typedef struct LSS_STR{
   EBOOL command_loaded;
   EBOOL general_error;
   LSS_ERROR error;
+
+  double timestamp; // Receive timestamp of the last reply in [s]
 }LSS_STR;
 
 extern LSS_STR lss;
+/*! \brief Sequence lock of lss, held by the reply handler while decoding */
+extern SMART_SEQLOCK lss_lock;
+
+/*! \brief Maximum number of requests sent with lss_send_requests() */
+#define LSS_MAX_REQUESTS 8
+
+/*! \brief Request to the LSS, sent as a load/no-load message pair */
+typedef struct LSS_REQUEST {
+  int get_attribute_id; ///< Attribute to be read back
+  int set_attribute_id; ///< Attribute to be written
+  int set_value; ///< Value to be written
+} LSS_REQUEST;
 
 void lss_init(int bus_id);
 
 int lss_send_request(int bus_id, int get_attribute_id, int set_attribute_id, int set_value, EBOOL load_data);
 
+// Send the load and no-load messages of a request in one batch
+int lss_send_request_pair(int bus_id, int get_attribute_id, int set_attribute_id, int set_value);
+
+// Send the message pairs of several requests in one batch
+int lss_send_requests(int bus_id, const LSS_REQUEST *requests, int count);
+
 // Position in mm
 int lss_save_position_limits(int bus_id, double min_position, double max_position);
 
@@ -123,5 +147,11 @@ int lss_set_brake_release(int bus_id);
 
 void lss_get_msg_handler(int handle, const CPC_MSG_T * cpcmsg);
 
+/*! \brief Consistent copy of the LSS state, taken without locking
+ *
+ * \param state Destination of the copy
+ */
+void lss_get_state(LSS_STR *state);
+
 
 #endif
@@ -0,0 +1,224 @@
+/*!
+ *  \file notify.c
+ *
+ *  \brief Subscriptions to changes of the signals received from the car
+ *
+ * The values of the previous message are kept per signal. They are
+ * shared by all subscriptions, and a subscription compares against them
+ * only once it has seen a value itself.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <libelrob/Edebug.h>
+
+#include "notify.h"
+
+/*! \brief Subscription to a signal or a message */
+typedef struct SMART_SUBSCRIPTION {
+  EBOOL active; ///< The subscription is in use
+  int signal; ///< The signal, -1 for all signals of the message
+  int can_id; ///< CAN ID of the message
+  SMART_NOTIFY_CONDITION condition; ///< Condition to be notified of
+  double threshold; ///< Threshold of the crossing conditions
+  SMART_NOTIFY_HANDLER handler; ///< Callback, 0 for the event descriptor
+  void *data; ///< User data passed to the callback
+  int fd; ///< Event descriptor, -1 if the subscription has a callback
+  EBOOL primed; ///< A value was received since subscribing
+} SMART_SUBSCRIPTION;
+
+static SMART_SUBSCRIPTION notify_subscriptions[SMART_MAX_SUBSCRIPTIONS];
+static pthread_mutex_t notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Number of subscriptions per CAN ID, read without the mutex */
+static unsigned char notify_counts[LIBCAN_NUM_IDS];
+/*! Values of the previous messages, indexed by the signals */
+static double notify_values[SMART_NUM_SIGNALS];
+
+/*!
+ *
+ * \brief adds a subscription
+ *
+ */
+static int notify_add(int signal, int can_id, SMART_NOTIFY_CONDITION condition,
+  double threshold, SMART_NOTIFY_HANDLER handler, void *data)
+{
+  SMART_SUBSCRIPTION *subscription;
+  int i, fd = -1;
+
+  if ((can_id < 0) || (can_id >= LIBCAN_NUM_IDS))
+    return -1;
+  if (!handler && ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)) {
+    perror("eventfd");
+    return -1;
+  }
+
+  pthread_mutex_lock(&notify_mutex);
+  for (i = 0; (i < SMART_MAX_SUBSCRIPTIONS) &&
+    notify_subscriptions[i].active; ++i);
+  if (i < SMART_MAX_SUBSCRIPTIONS) {
+    subscription = &notify_subscriptions[i];
+    subscription->signal = signal;
+    subscription->can_id = can_id;
+    subscription->condition = condition;
+    subscription->threshold = threshold;
+    subscription->handler = handler;
+    subscription->data = data;
+    subscription->fd = fd;
+    subscription->primed = EFALSE;
+    subscription->active = ETRUE;
+    __atomic_store_n(&notify_counts[can_id], notify_counts[can_id]+1,
+      __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&notify_mutex);
+
+  if (i == SMART_MAX_SUBSCRIPTIONS) {
+    EDBG("ERROR: too many subscriptions\n");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  return i;
+}
+
+/*!
+ *
+ * \brief checks the condition of a subscription to a signal
+ *
+ */
+static EBOOL notify_check(const SMART_SUBSCRIPTION *subscription,
+  double value)
+{
+  double previous = notify_values[subscription->signal];
+  EBOOL rising = (value > subscription->threshold) &&
+    (!subscription->primed || (previous <= subscription->threshold));
+  EBOOL falling = (value < subscription->threshold) &&
+    (!subscription->primed || (previous >= subscription->threshold));
+
+  switch (subscription->condition) {
+  case SMART_NOTIFY_RISING:
+    return rising;
+  case SMART_NOTIFY_FALLING:
+    return falling;
+  case SMART_NOTIFY_CROSSING:
+    return rising || falling;
+  default:
+    return !subscription->primed || (value != previous);
+  }
+}
+
+/*!
+ *
+ * \brief notifies a subscriber
+ *
+ */
+static void notify_signal(int id, SMART_SUBSCRIPTION *subscription,
+  int signal, double value, double timestamp)
+{
+  unsigned long long count = 1;
+
+  if (subscription->handler)
+    subscription->handler(id, signal, value, timestamp, subscription->data);
+  else if (write(subscription->fd, &count, sizeof(count)) < 0)
+    perror("smartNotify");
+}
+
+int smartSubscribe(SMART_SIGNAL_ID signal, SMART_NOTIFY_CONDITION condition,
+  double threshold, SMART_NOTIFY_HANDLER handler, void *data)
+{
+  if ((signal < 0) || (signal >= SMART_NUM_SIGNALS))
+    return -1;
+
+  return notify_add(signal, smart_signals[signal].can_id, condition,
+    threshold, handler, data);
+}
+
+int smartSubscribeMessage(int can_id, SMART_NOTIFY_HANDLER handler,
+  void *data)
+{
+  return notify_add(-1, can_id, SMART_NOTIFY_CHANGE, 0.0, handler, data);
+}
+
+int smartUnsubscribe(int id)
+{
+  SMART_SUBSCRIPTION *subscription;
+  int fd = -1;
+
+  if ((id < 0) || (id >= SMART_MAX_SUBSCRIPTIONS))
+    return -1;
+  subscription = &notify_subscriptions[id];
+
+  pthread_mutex_lock(&notify_mutex);
+  if (subscription->active) {
+    subscription->active = EFALSE;
+    fd = subscription->fd;
+    __atomic_store_n(&notify_counts[subscription->can_id],
+      notify_counts[subscription->can_id]-1, __ATOMIC_RELEASE);
+    id = 0;
+  }
+  else
+    id = -1;
+  pthread_mutex_unlock(&notify_mutex);
+
+  if (fd >= 0)
+    close(fd);
+
+  return id;
+}
+
+int smartGetSubscriptionFd(int id)
+{
+  if ((id < 0) || (id >= SMART_MAX_SUBSCRIPTIONS) ||
+      !notify_subscriptions[id].active)
+    return -1;
+
+  return notify_subscriptions[id].fd;
+}
+
+void smartNotify(const CPC_MSG_T *cpcmsg)
+{
+  SMART_SUBSCRIPTION *subscription;
+  int can_id = cpcmsg->msg.canmsg.id, i, signal;
+  double values[SMART_NUM_SIGNALS], timestamp;
+
+  if ((can_id < 0) || (can_id >= LIBCAN_NUM_IDS) ||
+      !__atomic_load_n(&notify_counts[can_id], __ATOMIC_ACQUIRE))
+    return;
+
+  if (!smartSignalsDecodeMessage(cpcmsg, values))
+    return;
+  timestamp = canGetTimestamp(cpcmsg);
+
+  pthread_mutex_lock(&notify_mutex);
+  for (i = 0; i < SMART_MAX_SUBSCRIPTIONS; ++i) {
+    subscription = &notify_subscriptions[i];
+    if (!subscription->active || (subscription->can_id != can_id))
+      continue;
+
+    if (subscription->signal >= 0) {
+      if (notify_check(subscription, values[subscription->signal]))
+        notify_signal(i, subscription, subscription->signal,
+          values[subscription->signal], timestamp);
+    }
+    else for (signal = 0; signal < SMART_NUM_SIGNALS; ++signal)
+      if ((smart_signals[signal].can_id == can_id) &&
+          (!subscription->primed || (values[signal] != notify_values[signal]))) {
+        notify_signal(i, subscription, signal, values[signal], timestamp);
+        /* The event descriptor is signaled once per message */
+        if (!subscription->handler)
+          break;
+      }
+
+    subscription->primed = ETRUE;
+  }
+
+  for (signal = 0; signal < SMART_NUM_SIGNALS; ++signal)
+    if (smart_signals[signal].can_id == can_id)
+      notify_values[signal] = values[signal];
+  pthread_mutex_unlock(&notify_mutex);
+}
@@ -0,0 +1,121 @@
+#ifndef SMART_NOTIFY_H
+#define SMART_NOTIFY_H
+
+#include <libcpc/cpclib.h>
+#include <libelrob/Etypes.h>
+
+#include "signals.h"
+
+/*! \defgroup smartlibnotify Change notifications of decoded signals
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file notify.h
+ *
+ *  \brief Subscriptions to changes of the signals received from the car
+ *
+ * Clients subscribe to a signal of signals.h, or to all signals of a
+ * message, together with a condition. When the message handlers have
+ * committed a message, the signals of the message with subscriptions are
+ * decoded once more and compared to the values of the previous message.
+ * Whenever a condition holds, the subscription's callback is called from
+ * the CAN thread, or its event descriptor is signaled, such that the
+ * client may wait for it, e.g. with poll() or in a reactor, and then read
+ * a snapshot with smartGetStatus(). Messages without subscriptions cost a
+ * single table lookup.
+ */
+
+/*! \brief Maximum number of subscriptions */
+#define SMART_MAX_SUBSCRIPTIONS 32
+
+/*! \brief Condition of a subscription */
+typedef enum SMART_NOTIFY_CONDITION {
+  SMART_NOTIFY_CHANGE, ///< The value changes
+  SMART_NOTIFY_RISING, ///< The value rises above the threshold
+  SMART_NOTIFY_FALLING, ///< The value falls below the threshold
+  SMART_NOTIFY_CROSSING ///< The value rises above or falls below the threshold
+} SMART_NOTIFY_CONDITION;
+
+/*! \brief Callback of a subscription
+ *
+ * The callback is called from the thread dispatching the message and must
+ * not subscribe or unsubscribe.
+ *
+ * \param subscription The subscription
+ * \param signal The signal whose value met the condition
+ * \param value The new value
+ * \param timestamp Receive timestamp of the message
+ * \param data User data given at subscription
+ */
+typedef void (*SMART_NOTIFY_HANDLER)(int subscription, SMART_SIGNAL_ID signal,
+  double value, double timestamp, void *data);
+
+/*!
+ *
+ * \brief Subscribe to a signal
+ *
+ * The first value received after subscribing counts as a change, and it
+ * counts as crossing the threshold if it is above or below the threshold,
+ * respectively.
+ *
+ * \param signal The signal
+ * \param condition Condition to be notified of
+ * \param threshold Threshold of the crossing conditions
+ * \param handler Callback, 0 to be notified through an event descriptor
+ * \param data User data passed to the callback
+ * \return The subscription or -1 on failure
+ *
+ */
+int smartSubscribe(SMART_SIGNAL_ID signal, SMART_NOTIFY_CONDITION condition,
+  double threshold, SMART_NOTIFY_HANDLER handler, void *data);
+
+/*!
+ *
+ * \brief Subscribe to the changes of all signals of a message
+ *
+ * The callback is called for every signal of the message that changed.
+ *
+ * \param can_id CAN ID of the message
+ * \param handler Callback, 0 to be notified through an event descriptor
+ * \param data User data passed to the callback
+ * \return The subscription or -1 on failure
+ *
+ */
+int smartSubscribeMessage(int can_id, SMART_NOTIFY_HANDLER handler,
+  void *data);
+
+/*!
+ *
+ * \brief Cancel a subscription
+ *
+ * \return 0 on success, -1 if there is no such subscription
+ *
+ */
+int smartUnsubscribe(int subscription);
+
+/*!
+ *
+ * \brief Event descriptor of a subscription without callback
+ *
+ * The descriptor becomes readable when the condition held since the last
+ * read, reading it returns the number of notifications.
+ *
+ * \return The descriptor or -1 if the subscription has a callback
+ *
+ */
+int smartGetSubscriptionFd(int subscription);
+
+/*!
+ *
+ * \brief Notify the subscribers of a received message
+ *
+ * Called by the message handlers after the message was committed.
+ *
+ */
+void smartNotify(const CPC_MSG_T *cpcmsg);
+
+/*@}*/
+#endif
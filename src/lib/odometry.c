@@ -0,0 +1,98 @@
+/*!
+ *  \file odometry.c
+ *
+ *  \brief Dead reckoning from the wheel speeds at their message rate
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "odometry.h"
+#include "seqlock.h"
+
+static SMART_ODOMETRY_CONFIG odometry_config = {
+  SMART_ODOMETRY_WHEEL_RADIUS,
+  SMART_ODOMETRY_TRACK,
+  SMART_ODOMETRY_WHEEL_BASE,
+};
+static SMART_ODOMETRY odometry;
+static SMART_SEQLOCK odometry_lock = SMART_SEQLOCK_INITIALIZER;
+
+void smartOdometryConfigure(const SMART_ODOMETRY_CONFIG *config)
+{
+  smartSeqlockWriteBegin(&odometry_lock);
+  odometry_config = *config;
+  smartSeqlockWriteEnd(&odometry_lock);
+}
+
+void smartOdometryReset(double x, double y, double yaw)
+{
+  smartSeqlockWriteBegin(&odometry_lock);
+  odometry.x = x;
+  odometry.y = y;
+  odometry.yaw = yaw;
+  odometry.distance = 0.0;
+  smartSeqlockWriteEnd(&odometry_lock);
+}
+
+void smartOdometryGet(SMART_ODOMETRY *state)
+{
+  smartSeqlockRead(&odometry_lock, state, &odometry, sizeof(odometry));
+}
+
+void smartOdometryUpdate(const SMART_VEHICLE_STATUS *status,
+  double timestamp)
+{
+  const SMART_WHEEL_SPEEDS *wheels = &status->wheelspeed;
+  double phi = status->status.phi_curr, circumference, fl, fr, rl, rr;
+  double v, yaw_rate, dt, heading;
+  EBOOL fl_ok = !wheels->front_left_not_plausible;
+  EBOOL fr_ok = !wheels->front_right_not_plausible;
+  EBOOL rl_ok = !wheels->rear_left_not_plausible;
+  EBOOL rr_ok = !wheels->rear_right_not_plausible;
+  int count = fl_ok+fr_ok+rl_ok+rr_ok;
+
+  smartSeqlockWriteBegin(&odometry_lock);
+  if (!count) {
+    ++odometry.rejected;
+    smartSeqlockWriteEnd(&odometry_lock);
+    return;
+  }
+
+  /* The front wheels roll in the steered direction */
+  circumference = 2.0*M_PI*odometry_config.wheel_radius;
+  fl = wheels->front_left*circumference*cos(phi);
+  fr = wheels->front_right*circumference*cos(phi);
+  rl = wheels->rear_left*circumference;
+  rr = wheels->rear_right*circumference;
+
+  /* The wheel speeds are unsigned */
+  v = (fl_ok*fl+fr_ok*fr+rl_ok*rl+rr_ok*rr)/count;
+  if (status->status.driving_direction == SMART_BACKWARDS)
+    v = -v;
+
+  /* Positive yaw rates turn left, with the right wheels outside */
+  if (rl_ok && rr_ok)
+    yaw_rate = (rr-rl)/odometry_config.track;
+  else if (fl_ok && fr_ok)
+    yaw_rate = (fr-fl)/odometry_config.track;
+  else
+    yaw_rate = fabs(v)*tan(phi)/odometry_config.wheel_base;
+  if (v < 0.0)
+    yaw_rate = -yaw_rate;
+
+  dt = timestamp-odometry.timestamp;
+  if (odometry.updates && (dt > 0.0) && (dt <= SMART_ODOMETRY_MAX_PERIOD)) {
+    /* Midpoint integration of the average speeds over the period */
+    heading = odometry.yaw+0.25*(odometry.yaw_rate+yaw_rate)*dt;
+    odometry.x += 0.5*(odometry.v+v)*dt*cos(heading);
+    odometry.y += 0.5*(odometry.v+v)*dt*sin(heading);
+    odometry.yaw += 0.5*(odometry.yaw_rate+yaw_rate)*dt;
+    odometry.distance += 0.5*fabs(odometry.v+v)*dt;
+  }
+  odometry.v = v;
+  odometry.yaw_rate = yaw_rate;
+  odometry.timestamp = timestamp;
+  ++odometry.updates;
+  smartSeqlockWriteEnd(&odometry_lock);
+}
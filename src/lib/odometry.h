@@ -0,0 +1,97 @@
+#ifndef SMART_ODOMETRY_H
+#define SMART_ODOMETRY_H
+
+#include <libelrob/Etypes.h>
+
+#include "smart.h"
+
+/*! \defgroup smartlibodometry Wheel odometry
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file odometry.h
+ *
+ *  \brief Dead reckoning from the wheel speeds at their message rate
+ *
+ * The pose of the rear axle center is integrated on every wheel speeds
+ * message (0x80). The speed is the mean of the plausible wheels, with the
+ * front wheels projected through the steering angle (0xC2), and the yaw
+ * rate is the speed difference of the plausible rear or front wheels over
+ * the track. If neither axle has two plausible wheels, the yaw rate
+ * follows from the steering angle and the wheel base. Wheels flagged as
+ * not plausible by the speed message (0x90) are excluded, and no update
+ * is integrated if all wheels are implausible.
+ */
+
+/*! \brief Default wheel radius in [m] */
+#define SMART_ODOMETRY_WHEEL_RADIUS 0.28
+/*! \brief Default track width in [m] */
+#define SMART_ODOMETRY_TRACK 1.28
+/*! \brief Default wheel base in [m] */
+#define SMART_ODOMETRY_WHEEL_BASE 1.81
+/*! \brief Updates further apart in [s] restart the integration */
+#define SMART_ODOMETRY_MAX_PERIOD 0.1
+
+/*! \brief Geometry of the car */
+typedef struct SMART_ODOMETRY_CONFIG {
+  double wheel_radius; ///< Wheel radius in [m]
+  double track; ///< Track width in [m]
+  double wheel_base; ///< Wheel base in [m]
+} SMART_ODOMETRY_CONFIG;
+
+/*! \brief Integrated pose of the car */
+typedef struct SMART_ODOMETRY {
+  double x; ///< Position in [m]
+  double y; ///< Position in [m]
+  double yaw; ///< Heading in [rad]
+  double distance; ///< Travelled distance in [m]
+  double v; ///< Speed in [m/s], negative when driving backwards
+  double yaw_rate; ///< Yaw rate in [rad/s]
+  double timestamp; ///< Receive timestamp of the last update in [s]
+  unsigned long updates; ///< Integrated updates
+  unsigned long rejected; ///< Updates without plausible wheels
+} SMART_ODOMETRY;
+
+/*!
+ *
+ * \brief Set the geometry of the car
+ *
+ */
+void smartOdometryConfigure(const SMART_ODOMETRY_CONFIG *config);
+
+/*!
+ *
+ * \brief Reset the integrated pose
+ *
+ * \param x Position in [m]
+ * \param y Position in [m]
+ * \param yaw Heading in [rad]
+ *
+ */
+void smartOdometryReset(double x, double y, double yaw);
+
+/*!
+ *
+ * \brief Consistent copy of the integrated pose, taken without locking
+ *
+ */
+void smartOdometryGet(SMART_ODOMETRY *odometry);
+
+/*!
+ *
+ * \brief Integrate the wheel speeds of a vehicle status
+ *
+ * Called by the wheel speeds handler after decoding.
+ *
+ * \param status The vehicle status
+ * \param timestamp Receive timestamp of the wheel speeds
+ *
+ */
+void smartOdometryUpdate(const SMART_VEHICLE_STATUS *status,
+  double timestamp);
+
+/*@}*/
+#endif
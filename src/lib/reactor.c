@@ -0,0 +1,226 @@
+/*!
+ *  \file reactor.c
+ *
+ *  \brief Single-threaded event loop for CAN message and timer handling
+ *
+ * All busses and timers of a reactor are watched through one epoll set.
+ * The event data identifies the source: the bus number for busses, the
+ * timer identifier offset by REACTOR_TIMER_EVENT for timers.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <libelrob/Edebug.h>
+
+#include "reactor.h"
+
+/*! Maximum number of events retrieved per wakeup */
+#define REACTOR_MAX_EVENTS (LIBCAN_MAX_CAN+CAN_REACTOR_MAX_TIMERS+1)
+
+#define REACTOR_BUS_EVENT   0x0000
+#define REACTOR_TIMER_EVENT 0x0100
+#define REACTOR_WAKE_EVENT  0x0200
+
+static int reactor_watch(CAN_REACTOR *reactor, int fd, unsigned int event)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = event;
+
+  return epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int canReactorInit(CAN_REACTOR *reactor)
+{
+  int i;
+
+  memset(reactor, 0, sizeof(CAN_REACTOR));
+  for (i = 0; i < CAN_REACTOR_MAX_TIMERS; ++i)
+    reactor->timers[i].fd = -1;
+
+  if ((reactor->epfd = epoll_create(REACTOR_MAX_EVENTS)) < 0) {
+    perror("epoll_create");
+    return -1;
+  }
+  if ((reactor->wakefd = eventfd(0, EFD_NONBLOCK)) < 0) {
+    perror("eventfd");
+    close(reactor->epfd);
+    return -1;
+  }
+  if (reactor_watch(reactor, reactor->wakefd, REACTOR_WAKE_EVENT)) {
+    perror("epoll_ctl");
+    close(reactor->wakefd);
+    close(reactor->epfd);
+    return -1;
+  }
+
+  return 0;
+}
+
+void canReactorCleanup(CAN_REACTOR *reactor)
+{
+  int i;
+
+  for (i = 0; i < CAN_REACTOR_MAX_TIMERS; ++i)
+    canReactorRemoveTimer(reactor, i);
+  for (i = 0; i < LIBCAN_MAX_CAN; ++i)
+    canReactorRemoveBus(reactor, i);
+
+  close(reactor->wakefd);
+  close(reactor->epfd);
+}
+
+int canReactorAddBus(CAN_REACTOR *reactor, int busId)
+{
+  int fd;
+
+  if ((busId < 0) || (busId >= LIBCAN_MAX_CAN) ||
+      ((fd = canHWGetFd(busId)) < 0)) {
+    EDBG("ERROR: CAN bus %d has not been initialized\n", busId);
+    return -1;
+  }
+  if (canGetBus(busId)->reader_running) {
+    EDBG("ERROR: CAN bus %d is read by its reader thread\n", busId);
+    return -1;
+  }
+  if (reactor_watch(reactor, fd, REACTOR_BUS_EVENT+busId)) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  reactor->bus_attached[busId] = ETRUE;
+  canGetBus(busId)->reactor_attached = ETRUE;
+
+  return 0;
+}
+
+int canReactorRemoveBus(CAN_REACTOR *reactor, int busId)
+{
+  if ((busId < 0) || (busId >= LIBCAN_MAX_CAN) ||
+      !reactor->bus_attached[busId])
+    return -1;
+
+  reactor->bus_attached[busId] = EFALSE;
+  canGetBus(busId)->reactor_attached = EFALSE;
+  return epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, canHWGetFd(busId), 0);
+}
+
+int canReactorAddTimer(CAN_REACTOR *reactor, double period,
+  CAN_REACTOR_TIMER_HANDLER handler, void *data)
+{
+  struct itimerspec spec;
+  CAN_REACTOR_TIMER *timer;
+  int i;
+
+  for (i = 0; (i < CAN_REACTOR_MAX_TIMERS) && (reactor->timers[i].fd >= 0);
+    ++i);
+  if ((i == CAN_REACTOR_MAX_TIMERS) || (period <= 0.0))
+    return -1;
+  timer = &reactor->timers[i];
+
+  if ((timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+    perror("timerfd_create");
+    return -1;
+  }
+
+  spec.it_interval.tv_sec = (time_t)period;
+  spec.it_interval.tv_nsec = (period-spec.it_interval.tv_sec)*1e9;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(timer->fd, 0, &spec, 0)) {
+    perror("timerfd_settime");
+    close(timer->fd);
+    timer->fd = -1;
+    return -1;
+  }
+  if (reactor_watch(reactor, timer->fd, REACTOR_TIMER_EVENT+i)) {
+    perror("epoll_ctl");
+    close(timer->fd);
+    timer->fd = -1;
+    return -1;
+  }
+
+  timer->handler = handler;
+  timer->data = data;
+  timer->expirations = 0;
+  timer->missed = 0;
+
+  return i;
+}
+
+int canReactorRemoveTimer(CAN_REACTOR *reactor, int timerId)
+{
+  if ((timerId < 0) || (timerId >= CAN_REACTOR_MAX_TIMERS) ||
+      (reactor->timers[timerId].fd < 0))
+    return -1;
+
+  close(reactor->timers[timerId].fd);
+  reactor->timers[timerId].fd = -1;
+
+  return 0;
+}
+
+int canReactorRunOnce(CAN_REACTOR *reactor, double timeout)
+{
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  CAN_REACTOR_TIMER *timer;
+  unsigned long long count;
+  int i, n;
+
+  n = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS,
+    (timeout < 0.0) ? -1 : (int)(timeout*1e3));
+  if (n < 0) {
+    if (errno == EINTR)
+      return 0;
+    perror("epoll_wait");
+    return -1;
+  }
+
+  for (i = 0; i < n; ++i) {
+    unsigned int event = events[i].data.u32;
+
+    if (event >= REACTOR_WAKE_EVENT) {
+      if (read(reactor->wakefd, &count, sizeof(count)) != sizeof(count))
+        continue;
+    }
+    else if (event >= REACTOR_TIMER_EVENT) {
+      timer = &reactor->timers[event-REACTOR_TIMER_EVENT];
+      /* Timers removed by a previous handler may still report events */
+      if ((timer->fd < 0) ||
+          (read(timer->fd, &count, sizeof(count)) != sizeof(count)))
+        continue;
+      timer->expirations += count;
+      timer->missed += count-1;
+      timer->handler(timer->data);
+    }
+    else if (reactor->bus_attached[event])
+      canHWProcess(event);
+  }
+
+  return n;
+}
+
+int canReactorRun(CAN_REACTOR *reactor)
+{
+  reactor->running = ETRUE;
+  while (reactor->running)
+    if (canReactorRunOnce(reactor, -1.0) < 0)
+      return -1;
+
+  return 0;
+}
+
+void canReactorStop(CAN_REACTOR *reactor)
+{
+  unsigned long long one = 1;
+
+  reactor->running = EFALSE;
+  if (write(reactor->wakefd, &one, sizeof(one)) < 0)
+    perror("write");
+}
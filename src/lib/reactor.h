@@ -0,0 +1,139 @@
+#ifndef SMART_REACTOR_H
+#define SMART_REACTOR_H
+
+#include <libelrob/Etypes.h>
+
+#include "can.h"
+
+/*! \defgroup smartlibreactor Event loop serving all CAN busses
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file reactor.h
+ *
+ *  \brief Single-threaded event loop for CAN message and timer handling
+ *
+ * The reactor waits on the file descriptors of all attached CAN busses at
+ * once and calls the registered message handlers of a bus as soon as it
+ * becomes readable. Periodic timers, such as the cycle of a controller, may
+ * be attached to the same loop.
+ */
+
+/*! \brief Maximum number of timers per reactor */
+#define CAN_REACTOR_MAX_TIMERS 8
+
+/*! \brief Timer callback, called with the user data given at registration */
+typedef void (*CAN_REACTOR_TIMER_HANDLER)(void *data);
+
+/*! \brief Periodic timer attached to a reactor */
+typedef struct CAN_REACTOR_TIMER {
+  int fd; ///< Timer file descriptor, -1 if unused
+  CAN_REACTOR_TIMER_HANDLER handler; ///< Callback for timer expiration
+  void *data; ///< User data passed to the callback
+  unsigned long long expirations; ///< Number of expirations
+  unsigned long long missed; ///< Expirations not served in time
+} CAN_REACTOR_TIMER;
+
+/*! \brief Event loop state */
+typedef struct CAN_REACTOR {
+  int epfd; ///< The epoll descriptor
+  int wakefd; ///< Event descriptor used to interrupt the loop
+  EBOOL bus_attached[LIBCAN_MAX_CAN]; ///< Busses served by the reactor
+  CAN_REACTOR_TIMER timers[CAN_REACTOR_MAX_TIMERS]; ///< Attached timers
+  volatile EBOOL running; ///< The loop runs until this flag is cleared
+} CAN_REACTOR;
+
+/*!
+ *
+ * \brief Init a reactor
+ *
+ * \param reactor The reactor to be initialized
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canReactorInit(CAN_REACTOR *reactor);
+
+/*!
+ *
+ * \brief Release all resources of a reactor
+ *
+ * Busses attached to the reactor are detached, but not closed.
+ *
+ */
+void canReactorCleanup(CAN_REACTOR *reactor);
+
+/*!
+ *
+ * \brief Attach an initialized CAN bus to a reactor
+ *
+ * Busses read by a reader thread cannot be attached, see
+ * canHWStartReader().
+ *
+ * \param busId CAN bus Number
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canReactorAddBus(CAN_REACTOR *reactor, int busId);
+
+/*!
+ *
+ * \brief Detach a CAN bus from a reactor
+ *
+ */
+int canReactorRemoveBus(CAN_REACTOR *reactor, int busId);
+
+/*!
+ *
+ * \brief Attach a periodic timer to a reactor
+ *
+ * \param period Timer period in [s]
+ * \param handler Callback for timer expiration
+ * \param data User data passed to the callback
+ * \return The timer's identifier or -1 on failure
+ *
+ */
+int canReactorAddTimer(CAN_REACTOR *reactor, double period,
+  CAN_REACTOR_TIMER_HANDLER handler, void *data);
+
+/*!
+ *
+ * \brief Detach a periodic timer from a reactor
+ *
+ * \param timerId The timer's identifier as returned by canReactorAddTimer()
+ *
+ */
+int canReactorRemoveTimer(CAN_REACTOR *reactor, int timerId);
+
+/*!
+ *
+ * \brief Wait once for events and dispatch them
+ *
+ * \param timeout Maximum waiting time in [s], negative to wait forever
+ * \return The number of served events or -1 on failure
+ *
+ */
+int canReactorRunOnce(CAN_REACTOR *reactor, double timeout);
+
+/*!
+ *
+ * \brief Serve events until canReactorStop() is called
+ *
+ * \return 0 if stopped, -1 on failure
+ *
+ */
+int canReactorRun(CAN_REACTOR *reactor);
+
+/*!
+ *
+ * \brief Make a running reactor return
+ *
+ * This function may be called from any thread or from within a handler.
+ *
+ */
+void canReactorStop(CAN_REACTOR *reactor);
+
+/*@}*/
+#endif
@@ -0,0 +1,211 @@
+/*!
+ *  \file replay.c
+ *
+ *  \brief Replay of recorded CAN traces through the message handlers
+ *
+ * Records are read ahead in blocks. A record is converted into a CPC
+ * message and passed to canDispatch(), so replayed messages take the same
+ * path through the dispatcher as received ones, but bypass the RX rings
+ * and the trace recorder.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <libelrob/Edebug.h>
+
+#include "replay.h"
+
+/*!
+ *
+ * \brief makes the next record available in the buffer
+ *
+ * \return ETRUE if a record is available, EFALSE at the end of the trace
+ *
+ */
+static EBOOL replay_fill(CAN_REPLAY *replay)
+{
+  ssize_t result;
+  size_t size = 0;
+
+  if (replay->pos < replay->count)
+    return ETRUE;
+
+  while (size < sizeof(replay->buffer)) {
+    result = read(replay->fd, (char*)replay->buffer+size,
+      sizeof(replay->buffer)-size);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("replay");
+      break;
+    }
+    if (!result)
+      break;
+    size += result;
+  }
+
+  /* A truncated last record is ignored */
+  replay->count = size/sizeof(CAN_TRACE_RECORD);
+  replay->pos = 0;
+
+  return (replay->count > 0);
+}
+
+/*!
+ *
+ * \brief passes a record to the message handlers
+ *
+ */
+static void replay_dispatch(CAN_REPLAY *replay,
+  const CAN_TRACE_RECORD *record, double timestamp)
+{
+  CPC_MSG_T cpcmsg;
+  int busId = (record->busId < LIBCAN_MAX_CAN) ?
+    replay->bus_map[record->busId] : -1;
+
+  if (((record->flags & CAN_TRACE_TX) && !replay->replay_tx) ||
+      (busId < 0)) {
+    ++replay->stats.skipped;
+    return;
+  }
+  /* Corrupt or foreign records, the recorder never writes more than 8 */
+  if (record->length > 8) {
+    ++replay->stats.invalid;
+    return;
+  }
+
+  memset(&cpcmsg, 0, offsetof(CPC_MSG_T, msg)+sizeof(CPC_CAN_MSG_T));
+  if (record->flags & CAN_TRACE_EXTENDED)
+    cpcmsg.type = (record->flags & CAN_TRACE_RTR) ? CPC_MSG_T_XRTR :
+      CPC_MSG_T_XCAN;
+  else
+    cpcmsg.type = (record->flags & CAN_TRACE_RTR) ? CPC_MSG_T_RTR :
+      CPC_MSG_T_CAN;
+  cpcmsg.length = sizeof(CPC_CAN_MSG_T);
+  cpcmsg.ts_sec = (long)timestamp;
+  cpcmsg.ts_nsec = (timestamp-cpcmsg.ts_sec)*1e9;
+
+  cpcmsg.msg.canmsg.id = record->id;
+  cpcmsg.msg.canmsg.length = record->length;
+  memcpy(cpcmsg.msg.canmsg.msg, record->data, record->length);
+
+  canDispatch(busId, &cpcmsg);
+  ++replay->stats.dispatched;
+}
+
+int canReplayOpen(CAN_REPLAY *replay, const char *filename, double speed)
+{
+  int i;
+
+  memset(replay, 0, sizeof(CAN_REPLAY));
+  if ((replay->fd = open(filename, O_RDONLY)) < 0) {
+    perror(filename);
+    return -1;
+  }
+
+  if ((read(replay->fd, &replay->header, sizeof(CAN_TRACE_HEADER)) !=
+      sizeof(CAN_TRACE_HEADER)) ||
+      memcmp(replay->header.magic, CAN_TRACE_MAGIC,
+        sizeof(replay->header.magic)) ||
+      (replay->header.version != CAN_TRACE_VERSION) ||
+      (replay->header.record_size != sizeof(CAN_TRACE_RECORD))) {
+    EDBG("ERROR: %s is not a valid CAN trace\n", filename);
+    close(replay->fd);
+    return -1;
+  }
+  posix_fadvise(replay->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  replay->speed = (speed > 0.0) ? speed : 0.0;
+  replay->replay_tx = EFALSE;
+  for (i = 0; i < LIBCAN_MAX_CAN; ++i)
+    replay->bus_map[i] = i;
+  replay->start_time = -1.0;
+
+  return 0;
+}
+
+void canReplayClose(CAN_REPLAY *replay)
+{
+  if (replay->fd >= 0)
+    close(replay->fd);
+  replay->fd = -1;
+}
+
+int canReplayRunOnce(CAN_REPLAY *replay, int max_messages)
+{
+  CAN_TRACE_RECORD *record;
+  double now = 0.0, due;
+  int count = 0;
+
+  if (!replay_fill(replay))
+    return -1;
+
+  if (replay->speed > 0.0) {
+    now = canGetTime();
+    if (replay->start_time < 0.0) {
+      replay->start_time = now;
+      replay->first_stamp = replay->buffer[replay->pos].timestamp;
+    }
+  }
+
+  while ((!max_messages || (count < max_messages)) && replay_fill(replay)) {
+    record = &replay->buffer[replay->pos];
+    ++replay->stats.records;
+
+    if (replay->speed > 0.0) {
+      due = replay->start_time+
+        (record->timestamp-replay->first_stamp)/replay->speed;
+      if (due > now) {
+        --replay->stats.records;
+        break;
+      }
+      if (now-due > replay->stats.max_lag)
+        replay->stats.max_lag = now-due;
+      replay_dispatch(replay, record, due);
+    }
+    else
+      replay_dispatch(replay, record, record->timestamp);
+
+    ++replay->pos;
+    ++count;
+  }
+
+  return count;
+}
+
+long canReplayRun(CAN_REPLAY *replay)
+{
+  struct timespec delay;
+  double due;
+  long count = 0;
+  int result;
+
+  while ((result = canReplayRunOnce(replay, 0)) >= 0) {
+    count += result;
+
+    /* Sleep until the next message is due */
+    if ((replay->speed > 0.0) && replay_fill(replay)) {
+      due = replay->start_time+(replay->buffer[replay->pos].timestamp-
+        replay->first_stamp)/replay->speed;
+      /* The due time refers to canGetTime(), which may be replaced, so the
+         delay is relative instead of a deadline of the monotonic clock */
+      due -= canGetTime();
+      if (due > 0.0) {
+        delay.tv_sec = (time_t)due;
+        delay.tv_nsec = (due-delay.tv_sec)*1e9;
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, 0);
+      }
+    }
+  }
+
+  EDBG("Replayed %lu messages, skipped %lu, %lu invalid\n",
+    replay->stats.dispatched, replay->stats.skipped, replay->stats.invalid);
+
+  return count;
+}
@@ -0,0 +1,111 @@
+#ifndef SMART_REPLAY_H
+#define SMART_REPLAY_H
+
+#include <libelrob/Etypes.h>
+
+#include "can.h"
+#include "trace.h"
+
+/*! \defgroup smartlibreplay Replay of recorded CAN traces
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file replay.h
+ *
+ *  \brief Replay of recorded CAN traces through the message handlers
+ *
+ * The messages of a trace file written by the trace recorder are passed to
+ * the message handlers registered on their busses, e.g. through
+ * register_msg_handlers(), exactly as if they were received from the
+ * hardware. Replay can be paced by the wall clock, optionally accelerated
+ * or slowed down, or run as fast as possible. Trace files are streamed in
+ * blocks of CAN_REPLAY_BUFFER_SIZE records, such that files of any size
+ * can be replayed.
+ */
+
+/*! \brief Number of records read from the trace file at once */
+#define CAN_REPLAY_BUFFER_SIZE 4096
+
+/*! \brief Statistics of a replay */
+typedef struct CAN_REPLAY_STATS {
+  unsigned long records; ///< Records read from the trace file
+  unsigned long dispatched; ///< Messages passed to the handlers
+  unsigned long skipped; ///< Sent messages or messages of unmapped busses
+  unsigned long invalid; ///< Records longer than 8 bytes, not dispatched
+  double max_lag; ///< Maximum delay of a paced message in [s]
+} CAN_REPLAY_STATS;
+
+/*! \brief State of a replay */
+typedef struct CAN_REPLAY {
+  int fd; ///< The trace file
+  CAN_TRACE_HEADER header; ///< Header of the trace file
+  CAN_TRACE_RECORD buffer[CAN_REPLAY_BUFFER_SIZE]; ///< Records read ahead
+  unsigned int count; ///< Number of records in the buffer
+  unsigned int pos; ///< Next record in the buffer
+  double speed; ///< Speed factor, 0 for as fast as possible
+  EBOOL replay_tx; ///< Also dispatch messages recorded as sent
+  int bus_map[LIBCAN_MAX_CAN]; ///< Replay bus of each recorded bus, -1 to skip
+  double first_stamp; ///< Timestamp of the first record
+  double start_time; ///< Time of canGetTime() the first record was due
+  CAN_REPLAY_STATS stats; ///< Statistics
+} CAN_REPLAY;
+
+/*!
+ *
+ * \brief Open a trace file for replay
+ *
+ * Recorded busses are replayed on the busses with the same numbers and
+ * messages recorded as sent are skipped. Both can be changed through the
+ * bus_map and replay_tx fields before the replay starts.
+ *
+ * \param filename Name of the trace file
+ * \param speed Speed factor relative to the recording, e.g. 1 for real
+ *   time or 10 for ten times faster, 0 to replay as fast as possible
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canReplayOpen(CAN_REPLAY *replay, const char *filename, double speed);
+
+/*!
+ *
+ * \brief Close the trace file of a replay
+ *
+ */
+void canReplayClose(CAN_REPLAY *replay);
+
+/*!
+ *
+ * \brief Dispatch all messages which are due
+ *
+ * Messages are due once their recorded time, relative to the first
+ * message and scaled by the speed factor, has elapsed since the first
+ * call. As fast as possible, the function dispatches up to max_messages
+ * messages. The function does not wait, so it may be called from a
+ * reactor timer.
+ *
+ * Paced messages are stamped with the time they were due, such that their
+ * timestamps compare to canGetTime(). Otherwise, they keep their recorded
+ * timestamps.
+ *
+ * \param max_messages Maximum number of messages, 0 for no limit
+ * \return The number of processed records or -1 at the end of the trace
+ *
+ */
+int canReplayRunOnce(CAN_REPLAY *replay, int max_messages);
+
+/*!
+ *
+ * \brief Dispatch all messages until the end of the trace
+ *
+ * Paced replay sleeps until the next message is due.
+ *
+ * \return The number of processed records
+ *
+ */
+long canReplayRun(CAN_REPLAY *replay);
+
+/*@}*/
+#endif
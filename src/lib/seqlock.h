@@ -0,0 +1,118 @@
+#ifndef SMART_SEQLOCK_H
+#define SMART_SEQLOCK_H
+
+#include <string.h>
+#include <pthread.h>
+
+/*! \defgroup smartlibseqlock Consistent snapshots of shared state
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file seqlock.h
+ *
+ *  \brief Sequence locks protecting state decoded by the CAN threads
+ *
+ * A writer increments the sequence number before and after an update, so
+ * the number is odd while the update is in progress. A reader copies the
+ * state without locking and retries if the sequence number was odd or
+ * changed in the meantime. Readers therefore never write to shared memory
+ * and cannot delay a writer, while writers only exclude each other.
+ */
+
+/*! \brief Hint to the CPU that the caller is spinning */
+#if defined(__i386__) || defined(__x86_64__)
+#define SMART_SEQLOCK_PAUSE() __builtin_ia32_pause()
+#else
+#define SMART_SEQLOCK_PAUSE()
+#endif
+
+/*! \brief Sequence lock, on a cache line of its own */
+typedef struct SMART_SEQLOCK {
+  unsigned int sequence; ///< Odd while an update is in progress
+  pthread_mutex_t mutex; ///< Serializes the writers
+} __attribute__((aligned(64))) SMART_SEQLOCK;
+
+/*! \brief Static initializer of a sequence lock */
+#define SMART_SEQLOCK_INITIALIZER {0, PTHREAD_MUTEX_INITIALIZER}
+
+/*!
+ *
+ * \brief Begin an update of the state protected by a sequence lock
+ *
+ */
+static inline void smartSeqlockWriteBegin(SMART_SEQLOCK *lock)
+{
+  pthread_mutex_lock(&lock->mutex);
+  __atomic_store_n(&lock->sequence, lock->sequence+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*!
+ *
+ * \brief Commit an update of the state protected by a sequence lock
+ *
+ */
+static inline void smartSeqlockWriteEnd(SMART_SEQLOCK *lock)
+{
+  __atomic_store_n(&lock->sequence, lock->sequence+1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock->mutex);
+}
+
+/*!
+ *
+ * \brief Begin reading the state protected by a sequence lock
+ *
+ * \return The sequence number to be passed to smartSeqlockReadRetry()
+ *
+ */
+static inline unsigned int smartSeqlockReadBegin(const SMART_SEQLOCK *lock)
+{
+  unsigned int sequence;
+
+  while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1)
+    SMART_SEQLOCK_PAUSE();
+
+  return sequence;
+}
+
+/*!
+ *
+ * \brief Check if the state read since smartSeqlockReadBegin() is torn
+ *
+ * \return Non-zero if the state was modified and must be read again
+ *
+ */
+static inline int smartSeqlockReadRetry(const SMART_SEQLOCK *lock,
+  unsigned int sequence)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (__atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+/*!
+ *
+ * \brief Copy the state protected by a sequence lock
+ *
+ * \param lock The sequence lock
+ * \param dst Destination of the consistent copy
+ * \param src The protected state
+ * \param size Size of the state
+ *
+ */
+static inline void smartSeqlockRead(const SMART_SEQLOCK *lock, void *dst,
+  const void *src, size_t size)
+{
+  unsigned int sequence;
+
+  do {
+    sequence = smartSeqlockReadBegin(lock);
+    memcpy(dst, src, size);
+  }
+  while (smartSeqlockReadRetry(lock, sequence));
+}
+
+/*@}*/
+#endif
@@ -0,0 +1,118 @@
+/*!
+ *  \file signal_table.h
+ *
+ *  \brief Description of the signals in the messages received from the car
+ *
+ * This file is a table and deliberately has no include guard. It is
+ * included by signals.h and signals.c with the macros below defined to
+ * generate the decoders, the signal identifiers and the signal descriptors.
+ *
+ * SIGNAL_MESSAGE(msg, can_id) opens the signals of a message and
+ * SIGNAL_MESSAGE_END(msg) closes them. Inside, every signal is either
+ *
+ * SIGNAL(msg, name, order, start, length, encoding, scale, offset, target)
+ *   a physical value assigned to the double target as raw*scale+offset, or
+ *
+ * FIELD(msg, name, order, start, length, target)
+ *   a raw integer value assigned to the integer or EBOOL target.
+ *
+ * The byte order LE numbers the bits from the LSB of byte 0 and start is
+ * the position of the signal's LSB. The byte order BE numbers the bits
+ * from the MSB of byte 0 and start is the position of the signal's MSB.
+ * Signals are at most 32 bits long. The encoding of a raw value is
+ * - U unsigned
+ * - S two's complement
+ * - H sign in the MSB, the magnitude of the high byte counted down from
+ *   128 for negative values (steering angle)
+ *
+ * The scale must be a constant expression, such that it is folded into a
+ * single multiplication.
+ */
+
+/* Speed and ABS, 10ms */
+SIGNAL_MESSAGE(speed, SMART_SPEED_CAN_ID)
+  FIELD(speed, abs_led_on, LE, 0, 1, smart.status.abs_led_on)
+  FIELD(speed, abs_active, LE, 1, 1, smart.status.abs_active)
+  FIELD(speed, esp_led_on, LE, 6, 1, smart.status.esp_led_on)
+  FIELD(speed, esp_led_blink, LE, 7, 1, smart.status.esp_led_blink)
+  FIELD(speed, front_left_not_plausible, LE, 32, 1,
+    smart.wheelspeed.front_left_not_plausible)
+  FIELD(speed, front_right_not_plausible, LE, 33, 1,
+    smart.wheelspeed.front_right_not_plausible)
+  FIELD(speed, rear_left_not_plausible, LE, 34, 1,
+    smart.wheelspeed.rear_left_not_plausible)
+  FIELD(speed, rear_right_not_plausible, LE, 36, 1,
+    smart.wheelspeed.rear_right_not_plausible)
+  SIGNAL(speed, v_curr, LE, 40, 16, U, KMH2MS(0.0625), 0.0,
+    smart.status.v_curr)
+SIGNAL_MESSAGE_END(speed)
+
+/* ESX state, 100ms */
+SIGNAL_MESSAGE(esx, SMART_ESX_CAN_ID)
+  FIELD(esx, vehicle_state, LE, 0, 8, esx.vehicle_state)
+  FIELD(esx, max_brake_stroke, LE, 8, 8, esx.max_brake_stroke)
+  FIELD(esx, brake_init_started, LE, 16, 8, esx.brake_init_started)
+  FIELD(esx, got_first_max_brake, LE, 24, 8, esx.got_first_max_brake)
+  FIELD(esx, request_pause, LE, 32, 8, esx.request_pause)
+  FIELD(esx, request_stop, LE, 40, 8, esx.request_stop)
+  FIELD(esx, control_lateral, LE, 48, 8, esx.control_lateral)
+  FIELD(esx, control_longitudinal, LE, 56, 8, esx.control_longitudinal)
+SIGNAL_MESSAGE_END(esx)
+
+/* Engine torques and gas pedal, 10ms */
+SIGNAL_MESSAGE(engine, SMART_ENGINE_CAN_ID)
+  SIGNAL(engine, drag_torque, LE, 0, 8, U, 1.0, 0.0, smart.engine.drag_torque)
+  SIGNAL(engine, indicated_torque, LE, 8, 8, U, 1.0, 0.0,
+    smart.engine.indicated_torque)
+  SIGNAL(engine, max_torque, LE, 16, 8, U, 1.0, 0.0, smart.engine.max_torque)
+  SIGNAL(engine, min_torque, LE, 24, 8, U, 1.0, 0.0, smart.engine.min_torque)
+  SIGNAL(engine, desired_torque, LE, 32, 8, U, 1.0, 0.0,
+    smart.engine.desired_torque)
+  SIGNAL(engine, pedal, LE, 40, 8, U, 1.0/2.5, 0.0, smart.engine.pedal)
+  SIGNAL(engine, motion_pedal, LE, 40, 8, U, 1.0/2.5, 0.0, smart.status.pedal)
+  SIGNAL(engine, status, LE, 48, 8, U, 1.0, 0.0, smart.engine.status)
+  FIELD(engine, brake_light_on, LE, 54, 1, smart.status.brake_light_on)
+SIGNAL_MESSAGE_END(engine)
+
+/* Engine speed and gears, 10ms */
+SIGNAL_MESSAGE(gear, SMART_GEAR_CAN_ID)
+  SIGNAL(gear, rpm, BE, 8, 16, U, 1.0, 0.0, smart.engine.rpm)
+  FIELD(gear, gear_byte, LE, 24, 8, smart.engine.gear_byte)
+  FIELD(gear, actual_gear, LE, 24, 4, smart.engine.actual_gear)
+  FIELD(gear, target_gear, LE, 28, 4, smart.engine.target_gear)
+SIGNAL_MESSAGE_END(gear)
+
+/* Steering wheel angle, converted to the wheel angle, 20ms */
+SIGNAL_MESSAGE(steering, SMART_STEERING_CAN_ID)
+  SIGNAL(steering, phi_curr, LE, 0, 16, H, DEG2RAD(0.04375)/STEERING_FACTOR,
+    0.0, smart.status.phi_curr)
+SIGNAL_MESSAGE_END(steering)
+
+/* Wheel speeds in 0.5rpm, converted to rounds per second, 20ms */
+SIGNAL_MESSAGE(wheelspeed, SMART_WHEEL_SPEEDS_CAN_ID)
+  SIGNAL(wheelspeed, front_right, BE, 0, 16, U, 1.0/(2.0*60.0), 0.0,
+    smart.wheelspeed.front_right)
+  SIGNAL(wheelspeed, front_left, BE, 16, 16, U, 1.0/(2.0*60.0), 0.0,
+    smart.wheelspeed.front_left)
+  SIGNAL(wheelspeed, rear_right, BE, 32, 16, U, 1.0/(2.0*60.0), 0.0,
+    smart.wheelspeed.rear_right)
+  SIGNAL(wheelspeed, rear_left, BE, 48, 16, U, 1.0/(2.0*60.0), 0.0,
+    smart.wheelspeed.rear_left)
+SIGNAL_MESSAGE_END(wheelspeed)
+
+/* State of the LSS brake motor, in every reply */
+SIGNAL_MESSAGE(lss, LSS_REPLY_CAN_ID)
+  FIELD(lss, motor_moving, LE, 0, 1, lss.motor_moving)
+  FIELD(lss, on_target_position, LE, 2, 1, lss.on_target_position)
+  FIELD(lss, general_error, LE, 3, 1, lss.general_error)
+  FIELD(lss, shaft_moving_up, LE, 4, 1, lss.shaft_moving_up)
+  FIELD(lss, homing_done, LE, 5, 1, lss.homing_done)
+  FIELD(lss, enable_moving, LE, 7, 1, lss.enable_moving)
+  FIELD(lss, error_input, LE, 16, 1, lss.error.input)
+  FIELD(lss, error_stroke_foward, LE, 17, 1, lss.error.stroke_foward)
+  FIELD(lss, error_stroke_reverse, LE, 18, 1, lss.error.stroke_reverse)
+  FIELD(lss, error_positive_limit, LE, 19, 1, lss.error.positive_limit)
+  FIELD(lss, error_negative_limit, LE, 20, 1, lss.error.negative_limit)
+  FIELD(lss, error_following, LE, 21, 1, lss.error.following)
+  FIELD(lss, command_loaded, LE, 23, 1, lss.command_loaded)
+SIGNAL_MESSAGE_END(lss)
@@ -0,0 +1,133 @@
+/*!
+ *  \file signals.c
+ *
+ *  \brief Descriptors and bulk decoders of the signals received from the car
+ */
+
+#include <math.h>
+
+#include "signals.h"
+
+const SMART_SIGNAL_INFO smart_signals[SMART_NUM_SIGNALS] = {
+#define SIGNAL_MESSAGE(msg, can_id)
+#define SIGNAL(msg, name, order, start, length, encoding, scale, offset, \
+    target) \
+  {#msg "." #name, SMART_SIGNAL_##msg##_CAN_ID, SMART_SIGNAL_##order, \
+    start, length, SMART_SIGNAL_##encoding, scale, offset},
+#define FIELD(msg, name, order, start, length, target) \
+  {#msg "." #name, SMART_SIGNAL_##msg##_CAN_ID, SMART_SIGNAL_##order, \
+    start, length, SMART_SIGNAL_U, 1.0, 0.0},
+#define SIGNAL_MESSAGE_END(msg)
+#include "signal_table.h"
+#undef SIGNAL_MESSAGE
+#undef SIGNAL
+#undef FIELD
+#undef SIGNAL_MESSAGE_END
+};
+
+int smartSignalsDecode(int can_id, const unsigned char *data, double *values)
+{
+  int count = 0;
+
+  switch (can_id) {
+#define SIGNAL_MESSAGE(msg, can_id) \
+  case SMART_SIGNAL_##msg##_CAN_ID:
+#define SIGNAL(msg, name, order, start, length, encoding, scale, offset, \
+    target) \
+    values[SMART_SIGNAL_##msg##_##name] = \
+      SIGNAL_RAW(data, order, start, length, encoding)*(scale)+(offset); \
+    ++count;
+#define FIELD(msg, name, order, start, length, target) \
+    values[SMART_SIGNAL_##msg##_##name] = \
+      SIGNAL_RAW(data, order, start, length, U); \
+    ++count;
+#define SIGNAL_MESSAGE_END(msg) \
+    break;
+#include "signal_table.h"
+#undef SIGNAL_MESSAGE
+#undef SIGNAL
+#undef FIELD
+#undef SIGNAL_MESSAGE_END
+  default:
+    break;
+  }
+
+  return count;
+}
+
+/*!
+ *
+ * \brief decodes the signals of a message of at most 8 data bytes
+ *
+ */
+static int signals_decode_padded(int can_id, const unsigned char *msg,
+  int length, double *values)
+{
+  unsigned char data[8];
+
+  /* Short messages are padded, since the decoders load all 8 bytes */
+  memset(data, 0, sizeof(data));
+  if (length > 0)
+    memcpy(data, msg, (length < 8) ? length : 8);
+
+  return smartSignalsDecode(can_id, data, values);
+}
+
+int smartSignalsDecodeMessage(const CPC_MSG_T *cpcmsg, double *values)
+{
+  return signals_decode_padded(cpcmsg->msg.canmsg.id,
+    (const unsigned char*)cpcmsg->msg.canmsg.msg, cpcmsg->msg.canmsg.length,
+    values);
+}
+
+long smartSignalsDecodeRecords(const CAN_TRACE_RECORD *records, long count,
+  const double *previous, double *values)
+{
+  long i, decoded = 0;
+  int j;
+
+  for (i = 0; i < count; ++i) {
+    if (i)
+      memcpy(values, values-SMART_NUM_SIGNALS,
+        SMART_NUM_SIGNALS*sizeof(double));
+    else if (previous)
+      memcpy(values, previous, SMART_NUM_SIGNALS*sizeof(double));
+    else
+      for (j = 0; j < SMART_NUM_SIGNALS; ++j)
+        values[j] = NAN;
+
+    if (!(records[i].flags & CAN_TRACE_TX) &&
+        signals_decode_padded(records[i].id, records[i].data,
+          records[i].length, values))
+      ++decoded;
+
+    values += SMART_NUM_SIGNALS;
+  }
+
+  return decoded;
+}
+
+double smartSignalDecode(SMART_SIGNAL_ID id, const unsigned char *data)
+{
+  const SMART_SIGNAL_INFO *info = &smart_signals[id];
+  unsigned long long bits;
+  long long raw;
+
+  if (info->order == SMART_SIGNAL_LE)
+    bits = SIGNAL_BITS_LE(data, info->start, info->length);
+  else
+    bits = SIGNAL_BITS_BE(data, info->start, info->length);
+
+  switch (info->encoding) {
+  case SMART_SIGNAL_S:
+    raw = SIGNAL_RAW_S(bits, info->length);
+    break;
+  case SMART_SIGNAL_H:
+    raw = SIGNAL_RAW_H(bits, info->length);
+    break;
+  default:
+    raw = SIGNAL_RAW_U(bits, info->length);
+  }
+
+  return raw*info->scale+info->offset;
+}
@@ -0,0 +1,209 @@
+#ifndef SMART_SIGNALS_H
+#define SMART_SIGNALS_H
+
+#include <math.h>
+#include <string.h>
+#include <endian.h>
+
+#include <libelrob/Etypes.h>
+#include <libelrob/Emacros.h>
+
+#include "smart.h"
+#include "handlers.h"
+#include "lss.h"
+#include "trace.h"
+
+/*! \defgroup smartlibsignals Table-driven signal decoders
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file signals.h
+ *
+ *  \brief Decoders of the signals received from the car
+ *
+ * The signals are described once in signal_table.h. From the table, the
+ * preprocessor generates a decoder per message, e.g. signals_decode_speed(),
+ * which assigns all signals of the message to their fields in smart, esx
+ * and lss. Positions, lengths and scales are constants of the generated
+ * code, so every signal compiles to a load, a shift, a mask and at most one
+ * multiplication, without branches.
+ *
+ * For the offline decoding of traces, the same table yields an identifier
+ * and a descriptor per signal, and smartSignalsDecode() decodes a message
+ * into an array of values indexed by these identifiers.
+ */
+
+/*! \brief Byte order of a signal */
+typedef enum SMART_SIGNAL_ORDER {
+  SMART_SIGNAL_LE, ///< Little endian, start is the position of the LSB
+  SMART_SIGNAL_BE ///< Big endian, start is the position of the MSB
+} SMART_SIGNAL_ORDER;
+
+/*! \brief Encoding of the raw value of a signal */
+typedef enum SMART_SIGNAL_ENCODING {
+  SMART_SIGNAL_U, ///< Unsigned
+  SMART_SIGNAL_S, ///< Two's complement
+  SMART_SIGNAL_H ///< Sign in the MSB, high byte counted down from 128
+} SMART_SIGNAL_ENCODING;
+
+/*! \brief CAN IDs of the messages, SMART_SIGNAL_<message>_CAN_ID */
+enum {
+#define SIGNAL_MESSAGE(msg, can_id) SMART_SIGNAL_##msg##_CAN_ID = can_id,
+#define SIGNAL(msg, name, order, start, length, encoding, scale, offset, \
+  target)
+#define FIELD(msg, name, order, start, length, target)
+#define SIGNAL_MESSAGE_END(msg)
+#include "signal_table.h"
+#undef SIGNAL_MESSAGE
+#undef SIGNAL
+#undef FIELD
+#undef SIGNAL_MESSAGE_END
+};
+
+/*! \brief Identifiers of the signals, SMART_SIGNAL_<message>_<signal> */
+typedef enum SMART_SIGNAL_ID {
+#define SIGNAL_MESSAGE(msg, can_id)
+#define SIGNAL(msg, name, order, start, length, encoding, scale, offset, \
+  target) SMART_SIGNAL_##msg##_##name,
+#define FIELD(msg, name, order, start, length, target) \
+  SMART_SIGNAL_##msg##_##name,
+#define SIGNAL_MESSAGE_END(msg)
+#include "signal_table.h"
+#undef SIGNAL_MESSAGE
+#undef SIGNAL
+#undef FIELD
+#undef SIGNAL_MESSAGE_END
+  SMART_NUM_SIGNALS ///< Number of signals
+} SMART_SIGNAL_ID;
+
+/*! \brief Description of a signal */
+typedef struct SMART_SIGNAL_INFO {
+  const char *name; ///< Name of the signal, <message>.<signal>
+  int can_id; ///< CAN ID of the message
+  SMART_SIGNAL_ORDER order; ///< Byte order
+  int start; ///< Start bit
+  int length; ///< Length in bits
+  SMART_SIGNAL_ENCODING encoding; ///< Encoding of the raw value
+  double scale; ///< Scale of the raw value
+  double offset; ///< Offset of the scaled value
+} SMART_SIGNAL_INFO;
+
+/*! \brief Descriptors of all signals, indexed by their identifiers */
+extern const SMART_SIGNAL_INFO smart_signals[SMART_NUM_SIGNALS];
+
+/*! \brief loads the 8 data bytes of a message in little endian order */
+static inline unsigned long long signals_load_LE(const unsigned char *data)
+{
+  unsigned long long value;
+
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+/*! \brief loads the 8 data bytes of a message in big endian order */
+static inline unsigned long long signals_load_BE(const unsigned char *data)
+{
+  unsigned long long value;
+
+  memcpy(&value, data, sizeof(value));
+  return be64toh(value);
+}
+
+/*! \brief extracts the raw bits of a signal */
+#define SIGNAL_BITS_LE(data, start, length) \
+  ((signals_load_LE(data) >> (start)) & ((1ULL << (length))-1))
+#define SIGNAL_BITS_BE(data, start, length) \
+  ((signals_load_BE(data) >> (64-(start)-(length))) & ((1ULL << (length))-1))
+
+/*! \brief converts the raw bits of a signal into an integer */
+#define SIGNAL_RAW_U(bits, length) ((long long)(bits))
+#define SIGNAL_RAW_S(bits, length) \
+  ((long long)((bits) << (64-(length))) >> (64-(length)))
+#define SIGNAL_RAW_H(bits, length) ((long long)(bits)+ \
+  (long long)(((bits) >> ((length)-1)) & 1)* \
+  ((1LL << ((length)-1))-2*(long long)((bits) & ~0xffULL)))
+
+/*! \brief raw integer value of a signal */
+#define SIGNAL_RAW(data, order, start, length, encoding) \
+  SIGNAL_RAW_##encoding(SIGNAL_BITS_##order(data, start, length), length)
+
+/* Decoders of the messages into smart, esx and lss */
+#define SIGNAL_MESSAGE(msg, can_id) \
+  static inline void signals_decode_##msg(const unsigned char *data) {
+#define SIGNAL(msg, name, order, start, length, encoding, scale, offset, \
+    target) \
+    target = SIGNAL_RAW(data, order, start, length, encoding)*(scale)+ \
+      (offset);
+#define FIELD(msg, name, order, start, length, target) \
+    target = SIGNAL_RAW(data, order, start, length, U);
+#define SIGNAL_MESSAGE_END(msg) }
+#include "signal_table.h"
+#undef SIGNAL_MESSAGE
+#undef SIGNAL
+#undef FIELD
+#undef SIGNAL_MESSAGE_END
+
+/*!
+ *
+ * \brief Decode the signals of a message into an array of values
+ *
+ * Values of signals not contained in the message are left untouched.
+ *
+ * \param can_id CAN ID of the message
+ * \param data The 8 data bytes of the message
+ * \param values Values of the signals, indexed by their identifiers
+ * \return The number of signals decoded, 0 for unknown messages
+ *
+ */
+int smartSignalsDecode(int can_id, const unsigned char *data, double *values);
+
+/*!
+ *
+ * \brief Decode the signals of a received message, see smartSignalsDecode()
+ *
+ * Messages shorter than 8 bytes are padded with zeros.
+ *
+ * \param cpcmsg The message
+ * \param values Values of the signals, indexed by their identifiers
+ * \return The number of signals decoded, 0 for unknown messages
+ *
+ */
+int smartSignalsDecodeMessage(const CPC_MSG_T *cpcmsg, double *values);
+
+/*!
+ *
+ * \brief Decode recorded messages into a table of values
+ *
+ * Each record yields a row of SMART_NUM_SIGNALS values. A row holds the
+ * values of the previous row, updated by the signals of its message, so
+ * every row is the state of the car after the record.
+ *
+ * \param records The recorded messages
+ * \param count Number of records
+ * \param previous Row preceding the first record, 0 for all values NAN
+ * \param values Table of count rows of SMART_NUM_SIGNALS values
+ * \return The number of records of known messages
+ *
+ */
+long smartSignalsDecodeRecords(const CAN_TRACE_RECORD *records, long count,
+  const double *previous, double *values);
+
+/*!
+ *
+ * \brief Decode a single signal from its descriptor
+ *
+ * This function is slower than the generated decoders, but handles signals
+ * selected at runtime.
+ *
+ * \param id Identifier of the signal
+ * \param data The 8 data bytes of the message
+ * \return The physical value of the signal
+ *
+ */
+double smartSignalDecode(SMART_SIGNAL_ID id, const unsigned char *data);
+
+/*@}*/
+#endif
@@ -0,0 +1,463 @@
+/*!
+ *  \file simulator.c
+ *
+ *  \brief Simulated vehicle answering on the CAN identifiers of the smart
+ *
+ * The messages are encoded such that the handlers in handlers.c and
+ * lss.c decode the state of the vehicle model. Acceleration and gear
+ * ratios follow the measurements behind predictAcc().
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <libelrob/Emacros.h>
+#include <libelrob/Edebug.h>
+
+#include "simulator.h"
+#include "handlers.h"
+#include "lss.h"
+#include "cst.h"
+
+/*! Maximum acceleration at full gas per gear in [m/s^2] */
+static const double sim_gear_acc[] = {0.0, 2.7, 1.87, 1.27, 0.87, 0.56};
+/*! Engine speed per vehicle speed per gear in [rpm/(m/s)] */
+static const double sim_gear_rpm[] = {0.0, 420.0, 260.0, 180.0, 135.0, 105.0};
+/*! Upshift speeds in [m/s] */
+static const double sim_gear_up[] = {0.0, 2.5, 6.0, 10.0, 15.0};
+
+/*! The message handlers reach the simulator through this pointer */
+static SMART_SIM *sim_instance = 0;
+
+static double sim_clock(void *data)
+{
+  return ((SMART_SIM*)data)->time;
+}
+
+/*!
+ *
+ * \brief converts a voltage message of the CST into volts
+ *
+ */
+static double sim_voltage(const CPC_MSG_T *cpcmsg, int channel)
+{
+  const unsigned char *msg = cpcmsg->msg.canmsg.msg+2*channel;
+
+  return (msg[0]+(msg[1]<<8))*V_MAX/4096.0;
+}
+
+static void sim_set_pedal(SMART_SIM_STATE *state, double voltage)
+{
+  double pedal;
+
+  state->pedal_voltage = voltage;
+  /* Inverse of the characteristic applied by cstSetPedalValue() */
+  pedal = (state->pedal_voltage-0.5325)/(0.0182*2.5);
+  state->pedal = (pedal < 0.0) ? 0.0 : (pedal > 100.0) ? 100.0 : pedal;
+}
+
+static void sim_pedal_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  sim_set_pedal(&sim_instance->state, sim_voltage(cpcmsg, 0));
+}
+
+static void sim_steering_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  sim_instance->state.steering_voltage = sim_voltage(cpcmsg, 0);
+}
+
+/*!
+ *
+ * \brief sets both outputs of the CST, channel 0 and 1 in one message
+ *
+ */
+static void sim_outputs_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  if (cpcmsg->msg.canmsg.length < 4)
+    return;
+
+  sim_set_pedal(&sim_instance->state, sim_voltage(cpcmsg, 0));
+  sim_instance->state.steering_voltage = sim_voltage(cpcmsg, 1);
+}
+
+/*!
+ *
+ * \brief sends a message from one of the simulator's busses
+ *
+ */
+static void sim_send(SMART_SIM *sim, int busId, int can_id, int length,
+  const unsigned char *msg)
+{
+  CAN_BUS *bus = canGetBus(busId);
+
+  if (bus && !canBusSend(bus, can_id, length, (const char*)msg))
+    ++sim->frames;
+}
+
+/*!
+ *
+ * \brief answers a request to the LSS brake motor
+ *
+ * Attributes are written on the second message of a load/no-load pair,
+ * which is also answered with the requested attribute.
+ *
+ */
+static void sim_lss_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  SMART_SIM *sim = sim_instance;
+  SMART_SIM_STATE *state = &sim->state;
+  const unsigned char *request = cpcmsg->msg.canmsg.msg;
+  unsigned char reply[8];
+  int value, get_attribute = request[1];
+
+  if (request[0] != LSS_DATA_HEADER)
+    return;
+
+  value = request[4]+(request[5]<<8)+(request[6]<<16)+(request[7]<<24);
+  switch (request[3]) {
+  case LSS_TARGET_POSITION:
+    state->brake_target = LSS_INC_TO_MM(value);
+    break;
+  case LSS_DRIVE_CURRENT:
+    state->brake_moving_current = value & 0xffff;
+    state->brake_holding_current = value >> 16;
+    break;
+  case LSS_EXEC_HOMING:
+    state->brake_target = (value == LSS_MAX_HOMING) ? LSS_MAX_POSITION :
+      LSS_MIN_POSITION;
+    state->brake_homing_done = ETRUE;
+    break;
+  }
+  if (state->brake_target < LSS_MIN_POSITION)
+    state->brake_target = LSS_MIN_POSITION;
+  if (state->brake_target > LSS_MAX_POSITION)
+    state->brake_target = LSS_MAX_POSITION;
+
+  if (get_attribute == LSS_NO_ATTRIBUTE)
+    return;
+
+  memset(reply, 0, sizeof(reply));
+  reply[0] = 0x80 | (state->brake_homing_done ? 0x20 : 0x00);
+  if (state->brake_target > state->brake_position)
+    reply[0] |= 0x10;
+  if (fabs(state->brake_target-state->brake_position) < 0.1)
+    reply[0] |= 0x04;
+  else
+    reply[0] |= 0x01;
+  reply[1] = get_attribute;
+  reply[2] = 0x80;
+
+  switch (get_attribute) {
+  case LSS_ACTUAL_POSITION:
+    value = LSS_MM_TO_INC(state->brake_position);
+    break;
+  case LSS_TARGET_POSITION:
+    value = LSS_MM_TO_INC(state->brake_target);
+    break;
+  case LSS_DRIVE_CURRENT:
+    value = state->brake_moving_current+(state->brake_holding_current<<16);
+    break;
+  default:
+    value = 0;
+  }
+  reply[4] = value & 0xff;
+  reply[5] = (value >> 8) & 0xff;
+  reply[6] = (value >> 16) & 0xff;
+  reply[7] = (value >> 24) & 0xff;
+
+  sim_send(sim, sim->icanBus, LSS_REPLY_CAN_ID, 8, reply);
+}
+
+/*!
+ *
+ * \brief answers a request to the configuration service of the CST
+ *
+ */
+static void sim_cst_handler(int busId, const CPC_MSG_T *cpcmsg)
+{
+  static const char *identification[] = {"SIMUL", "CST", "0000001"};
+  SMART_SIM *sim = sim_instance;
+  const CPC_CAN_MSG_T *request = &cpcmsg->msg.canmsg;
+  unsigned char reply[8];
+  int direction, variable, length = 1;
+
+  if (!request->length)
+    return;
+  if ((request->length == 8) && (request->msg[0] == 0x1)) {
+    ++sim->cst_sync_frames;
+    return;
+  }
+  if (request->msg[0] == CST_SWITCH_MODE) {
+    sim->cst_configuration = request->msg[1];
+    return;
+  }
+  if ((sim->cst_sync_frames < SMART_SIM_CST_SYNC_FRAMES) ||
+      !sim->cst_configuration)
+    return;
+
+  memset(reply, 0, sizeof(reply));
+  reply[0] = request->msg[0];
+  direction = request->msg[1] & 0x1;
+  variable = request->msg[2] & 0x3;
+  switch (request->msg[0]) {
+  case CST_CHECK_PRESENCE:
+    break;
+  case CST_INQUIRE_MANUFACTURER:
+  case CST_INQUIRE_PRODUCT:
+  case CST_INQUIRE_SERIAL:
+    strncpy((char*)reply+1,
+      identification[request->msg[0]-CST_INQUIRE_MANUFACTURER], 7);
+    length = 8;
+    break;
+  case CST_CONFIGURE_VARIABLE:
+    sim->cst_mapping[direction][variable] =
+      request->msg[3]+(request->msg[4] << 8);
+    length = 2;
+    break;
+  default:
+    return;
+  }
+
+  sim_send(sim, busId, CST_REPLY_CAN_ID, length, reply);
+}
+
+/*!
+ *
+ * \brief integrates the vehicle model over one step
+ *
+ */
+static void sim_integrate(SMART_SIM_STATE *state, double dt)
+{
+  double rate, brake_step, resistance, yaw_rate;
+
+  /* Power steering */
+  if ((state->steering_voltage >= STEERING_PHYSICAL_MIN_LIMIT) &&
+      (state->steering_voltage <= STEERING_PHYSICAL_MAX_LIMIT)) {
+    /* Voltages above neutral steer right, as assumed by cstSteeringPID() */
+    rate = -SMART_SIM_STEERING_GAIN*
+      (state->steering_voltage-SMART_SIM_STEERING_NEUTRAL);
+    state->steering_angle += rate*dt;
+    if (state->steering_angle > SMART_SIM_STEERING_MAX)
+      state->steering_angle = SMART_SIM_STEERING_MAX;
+    if (state->steering_angle < -SMART_SIM_STEERING_MAX)
+      state->steering_angle = -SMART_SIM_STEERING_MAX;
+  }
+
+  /* Brake motor */
+  brake_step = SMART_SIM_BRAKE_SPEED*dt;
+  if (fabs(state->brake_target-state->brake_position) <= brake_step)
+    state->brake_position = state->brake_target;
+  else
+    state->brake_position += (state->brake_target > state->brake_position) ?
+      brake_step : -brake_step;
+
+  /* Automatic gearbox */
+  if ((state->gear < 5) && (state->v > sim_gear_up[state->gear]))
+    ++state->gear;
+  else if ((state->gear > 1) && (state->v < 0.8*sim_gear_up[state->gear-1]))
+    --state->gear;
+  state->rpm = 800.0+state->v*sim_gear_rpm[state->gear];
+
+  /* Longitudinal dynamics */
+  resistance = 0.15+0.0004*state->v*state->v;
+  state->a = state->pedal/100.0*sim_gear_acc[state->gear];
+  if (state->v > 0.0)
+    state->a -= resistance+
+      state->brake_position/LSS_MAX_POSITION*SMART_SIM_BRAKE_MAX;
+  state->v += state->a*dt;
+  if (state->v < 0.0) {
+    state->v = 0.0;
+    state->a = 0.0;
+  }
+
+  /* Kinematic single track model */
+  yaw_rate = state->v*tan(DEG2RAD(state->steering_angle)/STEERING_FACTOR)/
+    SMART_SIM_WHEEL_BASE;
+  state->yaw += yaw_rate*dt;
+  state->x += state->v*cos(state->yaw)*dt;
+  state->y += state->v*sin(state->yaw)*dt;
+}
+
+static void sim_send_10ms(SMART_SIM *sim)
+{
+  SMART_SIM_STATE *state = &sim->state;
+  unsigned char msg[8];
+  int speed = state->v*3.6/0.0625;
+
+  /* Speed and ABS */
+  memset(msg, 0, sizeof(msg));
+  msg[5] = speed & 0xff;
+  msg[6] = (speed >> 8) & 0xff;
+  sim_send(sim, sim->vcanBus, SMART_SPEED_CAN_ID, 8, msg);
+
+  /* Engine torques, pedal and status */
+  memset(msg, 0, sizeof(msg));
+  msg[0] = 20;
+  msg[1] = msg[4] = 2.5*state->pedal;
+  msg[2] = 250;
+  msg[5] = 2.5*state->pedal;
+  msg[6] = 0x04 | ((state->brake_position > 1.0) ? 0x40 : 0x00);
+  sim_send(sim, sim->vcanBus, SMART_ENGINE_CAN_ID, 8, msg);
+
+  /* Engine speed and gear */
+  memset(msg, 0, sizeof(msg));
+  msg[1] = ((int)state->rpm >> 8) & 0xff;
+  msg[2] = (int)state->rpm & 0xff;
+  msg[3] = state->gear | (state->gear << 4);
+  sim_send(sim, sim->vcanBus, SMART_GEAR_CAN_ID, 8, msg);
+}
+
+static void sim_send_20ms(SMART_SIM *sim)
+{
+  SMART_SIM_STATE *state = &sim->state;
+  unsigned char msg[8];
+  int steer = state->steering_angle/0.04375, high, value, i;
+  double yaw_rate, wheel[4];
+
+  /* Steering angle, the sign is coded in the high byte's MSB */
+  memset(msg, 0, sizeof(msg));
+  if (steer >= 0)
+    high = (steer >> 8) & 0x7f;
+  else {
+    high = (-steer+255)/256;
+    steer += high*256;
+    high += 128;
+  }
+  msg[0] = steer & 0xff;
+  msg[1] = high;
+  sim_send(sim, sim->vcanBus, SMART_STEERING_CAN_ID, 8, msg);
+
+  /* Wheel speeds in 0.5rpm, front right, front left, rear right, rear left */
+  yaw_rate = state->v*tan(DEG2RAD(state->steering_angle)/STEERING_FACTOR)/
+    SMART_SIM_WHEEL_BASE;
+  wheel[0] = wheel[2] = state->v+0.5*SMART_SIM_TRACK*yaw_rate;
+  wheel[1] = wheel[3] = state->v-0.5*SMART_SIM_TRACK*yaw_rate;
+  for (i = 0; i < 4; ++i) {
+    value = (wheel[i] > 0.0) ?
+      wheel[i]/(2.0*M_PI*SMART_SIM_WHEEL_RADIUS)*120.0 : 0;
+    msg[2*i] = (value >> 8) & 0xff;
+    msg[2*i+1] = value & 0xff;
+  }
+  sim_send(sim, sim->vcanBus, SMART_WHEEL_SPEEDS_CAN_ID, 8, msg);
+}
+
+static void sim_send_100ms(SMART_SIM *sim)
+{
+  unsigned char msg[8];
+
+  msg[0] = sim->esx.vehicle_state;
+  msg[1] = sim->esx.max_brake_stroke;
+  msg[2] = sim->esx.brake_init_started;
+  msg[3] = sim->esx.got_first_max_brake;
+  msg[4] = sim->esx.request_pause;
+  msg[5] = sim->esx.request_stop;
+  msg[6] = sim->esx.control_lateral;
+  msg[7] = sim->esx.control_longitudinal;
+  sim_send(sim, sim->vcanBus, SMART_ESX_CAN_ID, 8, msg);
+}
+
+/*!
+ *
+ * \brief initializes a bus of the simulator
+ *
+ */
+static int sim_bus_init(int busId, char *network, int bitrate)
+{
+  static const int ids[] = {CST_ALL_CHANNELS_CAN_ID, CST_PEDAL_CAN_ID,
+    CST_STEERING_CAN_ID, LSS_CAN_ID, CST_REQUEST_CAN_ID};
+
+  if (canHWInitComType(busId, SMART_CAN_COM_VIRTUAL, bitrate, network) ||
+      canHWSetFilter(busId, ids, sizeof(ids)/sizeof(int)))
+    return -1;
+
+  canAddIdHandler(busId, CST_ALL_CHANNELS_CAN_ID, sim_outputs_handler);
+  canAddIdHandler(busId, CST_PEDAL_CAN_ID, sim_pedal_handler);
+  canAddIdHandler(busId, CST_STEERING_CAN_ID, sim_steering_handler);
+  canAddIdHandler(busId, LSS_CAN_ID, sim_lss_handler);
+  canAddIdHandler(busId, CST_REQUEST_CAN_ID, sim_cst_handler);
+
+  return 0;
+}
+
+int smartSimInit(SMART_SIM *sim, int vcanBus, char *vcanNetwork,
+  int icanBus, char *icanNetwork, EBOOL fast)
+{
+  if (sim_instance) {
+    EDBG("ERROR: a simulator is already running\n");
+    return -1;
+  }
+
+  memset(sim, 0, sizeof(SMART_SIM));
+  sim->vcanBus = vcanBus;
+  sim->icanBus = icanBus;
+  sim->fast = fast;
+  sim->state.gear = 1;
+  sim->state.rpm = 800.0;
+  sim->state.steering_voltage = SMART_SIM_STEERING_NEUTRAL;
+  sim->esx.control_lateral = 1;
+  sim->esx.control_longitudinal = 1;
+  sim_instance = sim;
+
+  if (fast)
+    canSetClock(sim_clock, sim);
+  else
+    sim->time = canGetTime();
+  sim->next_10ms = sim->next_20ms = sim->next_100ms = sim->time;
+
+  if (sim_bus_init(vcanBus, vcanNetwork, SMART_VCAN_BAUD_RATE) ||
+      ((icanBus != vcanBus) &&
+        sim_bus_init(icanBus, icanNetwork, SMART_ICAN_BAUD_RATE))) {
+    smartSimCleanup(sim);
+    return -1;
+  }
+
+  return 0;
+}
+
+void smartSimCleanup(SMART_SIM *sim)
+{
+  canHWCleanup(sim->vcanBus);
+  if (sim->icanBus != sim->vcanBus)
+    canHWCleanup(sim->icanBus);
+
+  if (sim->fast)
+    canSetClock(0, 0);
+  sim_instance = 0;
+}
+
+void smartSimStep(SMART_SIM *sim, double dt)
+{
+  double end = sim->time+dt, step;
+
+  while (sim->time < end) {
+    /* Commands are applied as soon as they are due */
+    canHWProcess(sim->vcanBus);
+    if (sim->icanBus != sim->vcanBus)
+      canHWProcess(sim->icanBus);
+
+    step = (end-sim->time < SMART_SIM_STEP) ? end-sim->time : SMART_SIM_STEP;
+    sim_integrate(&sim->state, step);
+    sim->time += step;
+
+    if (sim->time >= sim->next_10ms) {
+      sim_send_10ms(sim);
+      sim->next_10ms += 0.01;
+    }
+    if (sim->time >= sim->next_20ms) {
+      sim_send_20ms(sim);
+      sim->next_20ms += 0.02;
+    }
+    if (sim->time >= sim->next_100ms) {
+      sim_send_100ms(sim);
+      sim->next_100ms += 0.1;
+    }
+  }
+}
+
+void smartSimTimerHandler(void *sim)
+{
+  SMART_SIM *simulator = sim;
+
+  if (!simulator->fast)
+    smartSimStep(simulator, canGetTime()-simulator->time);
+}
@@ -0,0 +1,144 @@
+#ifndef SMART_SIMULATOR_H
+#define SMART_SIMULATOR_H
+
+#include <libelrob/Etypes.h>
+
+#include "smart.h"
+#include "can.h"
+
+/*! \defgroup smartlibsim Simulated vehicle on virtual CAN busses
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file simulator.h
+ *
+ *  \brief Simulated vehicle answering on the CAN identifiers of the smart
+ *
+ * The simulator attaches its own busses to virtual CAN networks and
+ * behaves like the vehicle and its actuators: it receives the pedal and
+ * steering voltages of the CST (0x35, 0x36, or both on 0x33) and the
+ * requests to the LSS brake motor (0x23f), answers the configuration
+ * service of the CST (0x7e5, 0x7e4) once it received
+ * SMART_SIM_CST_SYNC_FRAMES synchronization frames, integrates a
+ * longitudinal and lateral model of the car, and emits the speed (0x90) and engine (0x310, 0x300) messages every
+ * 10ms, the steering angle (0xC2) and wheel speeds (0x80) every 20ms, the
+ * ESX state (0x88) every 100ms and the LSS replies (0x1bf).
+ *
+ * In real time, the simulator is stepped by the wall clock, e.g. from a
+ * reactor timer. In fast mode, it owns the clock of canGetTime() and
+ * the simulated time only advances through smartSimStep(), so a test
+ * can step it as fast as the stack processes the messages.
+ */
+
+/*! \brief Integration step of the vehicle model in [s] */
+#define SMART_SIM_STEP 0.001
+/*! \brief Steering voltage at which the power steering applies no torque */
+#define SMART_SIM_STEERING_NEUTRAL 2.5
+/*! \brief Steering wheel rate per volt below neutral in [deg/s/V] */
+#define SMART_SIM_STEERING_GAIN 400.0
+/*! \brief Maximum steering wheel angle in [deg] */
+#define SMART_SIM_STEERING_MAX 720.0
+/*! \brief Deceleration at full brake stroke in [m/s^2] */
+#define SMART_SIM_BRAKE_MAX 8.0
+/*! \brief Speed of the brake motor in [mm/s] */
+#define SMART_SIM_BRAKE_SPEED 50.0
+/*! \brief Wheel base in [m] */
+#define SMART_SIM_WHEEL_BASE 1.81
+/*! \brief Track width in [m] */
+#define SMART_SIM_TRACK 1.28
+/*! \brief Wheel radius in [m] */
+#define SMART_SIM_WHEEL_RADIUS 0.28
+/*! \brief Synchronization frames until the simulated CST answers */
+#define SMART_SIM_CST_SYNC_FRAMES 20
+
+/*! \brief State of the simulated vehicle */
+typedef struct SMART_SIM_STATE {
+  double x; ///< Position in [m]
+  double y; ///< Position in [m]
+  double yaw; ///< Heading in [rad]
+  double v; ///< Speed in [m/s]
+  double a; ///< Acceleration in [m/s^2]
+  double steering_angle; ///< Steering wheel angle in [deg]
+  double pedal; ///< Gas pedal in percent
+  double pedal_voltage; ///< Last pedal voltage received in [V]
+  double steering_voltage; ///< Last steering voltage received in [V]
+  double brake_position; ///< Brake motor position in [mm]
+  double brake_target; ///< Brake motor target position in [mm]
+  int brake_moving_current; ///< Raw moving current of the brake motor
+  int brake_holding_current; ///< Raw holding current of the brake motor
+  EBOOL brake_homing_done; ///< Homing of the brake motor was executed
+  int gear; ///< Engaged gear
+  double rpm; ///< Engine speed
+} SMART_SIM_STATE;
+
+/*! \brief Simulated vehicle */
+typedef struct SMART_SIM {
+  int vcanBus; ///< Bus of the simulator attached to the VCAN network
+  int icanBus; ///< Bus of the simulator attached to the ICAN network
+  EBOOL fast; ///< The simulated time is decoupled from the wall clock
+  double time; ///< Simulated time in [s]
+  double next_10ms; ///< Time of the next 10ms messages
+  double next_20ms; ///< Time of the next 20ms messages
+  double next_100ms; ///< Time of the next 100ms messages
+  SMART_SIM_STATE state; ///< State of the vehicle model
+  ESX_STR esx; ///< State reported by the simulated ESX
+  int cst_sync_frames; ///< Synchronization frames received by the CST
+  EBOOL cst_configuration; ///< The CST is in configuration mode
+  int cst_mapping[2][4]; ///< CAN IDs of the CST variables per direction
+  unsigned long frames; ///< Messages emitted
+} SMART_SIM;
+
+/*!
+ *
+ * \brief Attach a simulated vehicle to the virtual CAN networks
+ *
+ * The simulator's busses are initialized as virtual busses accepting the
+ * actuator commands only. With HAVE_ESX, both networks are the same and
+ * vcanBus may equal icanBus. Only one simulator may exist at a time.
+ *
+ * \param vcanBus Bus number of the simulator on the VCAN network
+ * \param vcanNetwork Name of the VCAN network
+ * \param icanBus Bus number of the simulator on the ICAN network
+ * \param icanNetwork Name of the ICAN network
+ * \param fast Decouple the simulated time from the wall clock
+ * \return 0 on success, -1 on failure
+ *
+ */
+int smartSimInit(SMART_SIM *sim, int vcanBus, char *vcanNetwork,
+  int icanBus, char *icanNetwork, EBOOL fast);
+
+/*!
+ *
+ * \brief Detach a simulated vehicle from the virtual CAN networks
+ *
+ */
+void smartSimCleanup(SMART_SIM *sim);
+
+/*!
+ *
+ * \brief Advance the simulation
+ *
+ * Received commands are applied, the vehicle model is integrated and all
+ * messages due within the step are emitted.
+ *
+ * \param dt Time step in [s]
+ *
+ */
+void smartSimStep(SMART_SIM *sim, double dt);
+
+/*!
+ *
+ * \brief Advance a real time simulation to the wall clock
+ *
+ * This function may be attached to a reactor as timer handler.
+ *
+ * \param sim The simulator
+ *
+ */
+void smartSimTimerHandler(void *sim);
+
+/*@}*/
+#endif
@@ -58,12 +58,18 @@ The module smart contains a complete abstraction layer of the vehicle. It provid
 
 #define KMH2MS(kmh)                ((kmh)/3.6)
 
+/*! \brief Weight of a new period in the average period of a message */
+#define SMART_FRESHNESS_ALPHA 0.1
+/*! \brief Number of nominal periods after which a message is stale */
+#define SMART_STALE_PERIODS 3.0
+
 #define WINDOW                     3
 
-/*! \brief Defines if we use the USB-CAN converters or work on the PCI cards of
-the rack
+/*! \brief Defines if we use the USB-CAN converters, work on the PCI cards of
+the rack, or access either of them through the kernel's SocketCAN stack
  */
-typedef enum _SMART_CAN_COM_TYPE { SMART_CAN_COM_USB, SMART_CAN_COM_PCI}
+typedef enum _SMART_CAN_COM_TYPE { SMART_CAN_COM_USB, SMART_CAN_COM_PCI,
+  SMART_CAN_COM_SOCKET, SMART_CAN_COM_VIRTUAL}
 SMART_CAN_COM_TYPE;
 
 typedef enum _SMART_DIRECTION {
@@ -116,16 +122,50 @@ typedef struct SMART_MOTION {
   EBOOL abs_active; ///< ABS is active, controlling the brake
   SMART_DIRECTION driving_direction; ///<driving direction (works only from a minimum veloctity)
   EBOOL brake_light_on; ///< indicates if the brake light is on saying if the brake is pressed or not
-  TIMEVAL t_curr; ///< Timestamp
+  TIMEVAL t_curr; ///< Receive timestamp of v_curr in the monotonic clock domain
 } SMART_MOTION;
 
+/*! \brief receive timestamps of the decoded messages in [s]
+ *
+ * The timestamps are taken on reception of the messages in the monotonic
+ * clock domain of canGetTime().
+ */
+typedef struct SMART_TIMESTAMPS {
+  double speed; ///< Speed message: v_curr, ABS and ESP state
+  double engine; ///< Engine message: torques, pedal, driving direction
+  double gear; ///< Gear message: rpm and gears
+  double steering; ///< Steering angle message: phi_curr
+  double wheelspeed; ///< Wheel speeds message
+} SMART_TIMESTAMPS;
+
+
+/*! \brief groups of signals decoded from the same message */
+typedef enum _SMART_MESSAGE_GROUP {
+  SMART_GROUP_SPEED, ///< Speed message, 10ms
+  SMART_GROUP_ENGINE, ///< Engine message, 10ms
+  SMART_GROUP_GEAR, ///< Gear message, 10ms
+  SMART_GROUP_STEERING, ///< Steering angle message, 20ms
+  SMART_GROUP_WHEELSPEED, ///< Wheel speeds message, 20ms
+  SMART_GROUP_ESX, ///< ESX state message, 100ms
+  SMART_NUM_GROUPS
+} SMART_MESSAGE_GROUP;
+
+/*! \brief freshness of a group of signals */
+typedef struct SMART_FRESHNESS {
+  double timestamp; ///< Receive timestamp of the last update in [s]
+  double period; ///< Exponentially averaged update period in [s]
+  unsigned long updates; ///< Number of updates
+  unsigned long gaps; ///< Periods longer than SMART_STALE_PERIODS nominal ones
+} SMART_FRESHNESS;
 
 /*! \brief overall status of the car */
 typedef struct SMART_VEHICLE_STATUS {
   SMART_ENGINE engine;///< engine status (torques, rpms, etc)
   SMART_WHEEL_SPEEDS wheelspeed; ///< the speeds for the single wheels in turns/second
   SMART_MOTION status;///<  Pedal value, steering angle and translational speed of the car
-  double update_rate;
+  SMART_TIMESTAMPS timestamps; ///< Receive timestamps of the decoded messages
+  SMART_FRESHNESS freshness[SMART_NUM_GROUPS]; ///< Freshness per message
+  double update_rate; ///< Averaged update rate of v_curr in [Hz]
 }SMART_VEHICLE_STATUS;
 
 /*! \brief holds global configuration of the smart module
@@ -194,6 +234,7 @@ typedef struct _ESX_STR {
   int request_stop;
   int control_lateral;
   int control_longitudinal;
+  double timestamp; ///< Receive timestamp in the monotonic clock domain
 } ESX_STR;
 
 typedef struct _S_JOYSTICK {
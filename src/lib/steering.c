@@ -0,0 +1,261 @@
+/*!
+ *  \file steering.c
+ *
+ *  \brief Steering control loop executed at a fixed rate
+ *
+ * Deadlines are kept as timespecs to avoid the rounding of doubles
+ * accumulating over long runs.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include <libelrob/Edebug.h>
+
+#include "steering.h"
+#include "handlers.h"
+#include "can.h"
+
+static void steering_add(struct timespec *time, long nsec)
+{
+  time->tv_nsec += nsec;
+  while (time->tv_nsec >= 1000000000L) {
+    time->tv_nsec -= 1000000000L;
+    ++time->tv_sec;
+  }
+}
+
+static double steering_diff(const struct timespec *end,
+  const struct timespec *start)
+{
+  return (end->tv_sec-start->tv_sec)+(end->tv_nsec-start->tv_nsec)*1e-9;
+}
+
+static void steering_histogram_reset(SMART_STEERING_HISTOGRAM *histogram)
+{
+  memset(histogram, 0, sizeof(SMART_STEERING_HISTOGRAM));
+  histogram->min = INFINITY;
+  histogram->max = -INFINITY;
+}
+
+static void steering_histogram_add(SMART_STEERING_HISTOGRAM *histogram,
+  double duration)
+{
+  int bin = duration/SMART_STEERING_HISTOGRAM_RESOLUTION;
+
+  if (bin < 0)
+    bin = 0;
+  else if (bin >= SMART_STEERING_HISTOGRAM_BINS)
+    bin = SMART_STEERING_HISTOGRAM_BINS-1;
+
+  ++histogram->bins[bin];
+  ++histogram->count;
+  histogram->min = fmin(histogram->min, duration);
+  histogram->max = fmax(histogram->max, duration);
+  histogram->sum += duration;
+}
+
+/*!
+ *
+ * \brief one cycle of the loop: read the angle, run the PID, send
+ *
+ * Without a fresh steering angle the neutral voltage is sent and the PID
+ * is reset, rather than holding the last output.
+ *
+ * \return ETRUE if the voltage of the PID was sent
+ *
+ */
+static EBOOL steering_cycle(SMART_STEERING_LOOP *loop, double period)
+{
+  SMART_VEHICLE_STATUS status;
+  double target, voltage;
+
+  smartGetStatus(&status);
+  if (smartIsStale(&status, SMART_GROUP_STEERING, canGetTime())) {
+    cstPIDReset(&loop->pid);
+    cstSetSteeringVoltage(loop->config.busId, CST_PID_NEUTRAL_OUTPUT);
+    loop->voltage = CST_PID_NEUTRAL_OUTPUT;
+    return EFALSE;
+  }
+
+  pthread_mutex_lock(&loop->mutex);
+  target = loop->target;
+  pthread_mutex_unlock(&loop->mutex);
+
+  voltage = cstPIDStep(&loop->pid, period, target, status.status.phi_curr);
+  if (voltage > STEERING_CONTROL_MAX_OUTPUT_VOLTAGE)
+    voltage = STEERING_CONTROL_MAX_OUTPUT_VOLTAGE;
+  else if (voltage < STEERING_CONTROL_MIN_OUTPUT_VOLTAGE)
+    voltage = STEERING_CONTROL_MIN_OUTPUT_VOLTAGE;
+
+  cstSetSteeringVoltage(loop->config.busId, voltage);
+  loop->voltage = voltage;
+
+  return ETRUE;
+}
+
+static void *steering_thread(void *data)
+{
+  SMART_STEERING_LOOP *loop = data;
+  struct timespec deadline, wakeup, last_wakeup, end;
+  long period_nsec = 1e9/loop->config.rate;
+  double period = period_nsec*1e-9, overrun;
+  EBOOL sent, first = ETRUE;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  last_wakeup = deadline;
+
+  while (loop->running) {
+    steering_add(&deadline, period_nsec);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) ==
+      EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &wakeup);
+
+    sent = steering_cycle(loop, period);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&loop->mutex);
+    ++loop->stats.cycles;
+    if (!sent)
+      ++loop->stats.stale;
+    steering_histogram_add(&loop->stats.latency,
+      steering_diff(&wakeup, &deadline));
+    if (!first)
+      steering_histogram_add(&loop->stats.jitter,
+        fabs(steering_diff(&wakeup, &last_wakeup)-period));
+    steering_histogram_add(&loop->stats.compute,
+      steering_diff(&end, &wakeup));
+
+    /* Overrun periods are skipped, the next deadline lies ahead */
+    overrun = steering_diff(&end, &deadline);
+    if (overrun > period) {
+      ++loop->stats.misses;
+      while (steering_diff(&end, &deadline) > period) {
+        steering_add(&deadline, period_nsec);
+        ++loop->stats.skipped;
+      }
+    }
+    pthread_mutex_unlock(&loop->mutex);
+
+    last_wakeup = wakeup;
+    first = EFALSE;
+  }
+
+  return 0;
+}
+
+int smartSteeringStart(SMART_STEERING_LOOP *loop,
+  const SMART_STEERING_CONFIG *config)
+{
+  pthread_attr_t attributes;
+  struct sched_param parameters;
+  cpu_set_t cpus;
+  int result;
+
+  if (config->rate <= 0.0) {
+    EDBG("ERROR: invalid steering loop rate %f\n", config->rate);
+    return -1;
+  }
+
+  memset(loop, 0, sizeof(SMART_STEERING_LOOP));
+  loop->config = *config;
+  cstPIDInit(&loop->pid, &config->gains);
+  smartSteeringResetStats(loop);
+  pthread_mutex_init(&loop->mutex, 0);
+
+  pthread_attr_init(&attributes);
+  if (config->priority > 0) {
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.sched_priority = config->priority;
+    pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attributes, SCHED_FIFO);
+    pthread_attr_setschedparam(&attributes, &parameters);
+  }
+  if (config->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(config->cpu, &cpus);
+    pthread_attr_setaffinity_np(&attributes, sizeof(cpus), &cpus);
+  }
+
+  loop->running = ETRUE;
+  result = pthread_create(&loop->thread, &attributes, steering_thread, loop);
+  pthread_attr_destroy(&attributes);
+
+  if (result && ((config->priority > 0) || (config->cpu >= 0))) {
+    EDBG("WARNING: failed to set the steering loop's scheduling, "
+      "using the default\n");
+    result = pthread_create(&loop->thread, 0, steering_thread, loop);
+  }
+  if (result) {
+    EDBG("ERROR: failed to start the steering loop\n");
+    loop->running = EFALSE;
+    pthread_mutex_destroy(&loop->mutex);
+    return -1;
+  }
+
+  return 0;
+}
+
+void smartSteeringStop(SMART_STEERING_LOOP *loop)
+{
+  if (!loop->running)
+    return;
+
+  loop->running = EFALSE;
+  pthread_join(loop->thread, 0);
+  pthread_mutex_destroy(&loop->mutex);
+}
+
+void smartSteeringSetTarget(SMART_STEERING_LOOP *loop, double angle)
+{
+  pthread_mutex_lock(&loop->mutex);
+  loop->target = angle;
+  pthread_mutex_unlock(&loop->mutex);
+}
+
+void smartSteeringGetStats(SMART_STEERING_LOOP *loop,
+  SMART_STEERING_STATS *stats)
+{
+  pthread_mutex_lock(&loop->mutex);
+  *stats = loop->stats;
+  pthread_mutex_unlock(&loop->mutex);
+}
+
+void smartSteeringResetStats(SMART_STEERING_LOOP *loop)
+{
+  if (loop->running)
+    pthread_mutex_lock(&loop->mutex);
+
+  loop->stats.cycles = 0;
+  loop->stats.misses = 0;
+  loop->stats.skipped = 0;
+  loop->stats.stale = 0;
+  steering_histogram_reset(&loop->stats.latency);
+  steering_histogram_reset(&loop->stats.jitter);
+  steering_histogram_reset(&loop->stats.compute);
+
+  if (loop->running)
+    pthread_mutex_unlock(&loop->mutex);
+}
+
+double smartSteeringQuantile(const SMART_STEERING_HISTOGRAM *histogram,
+  double quantile)
+{
+  unsigned long count = 0;
+  int bin;
+
+  if (!histogram->count)
+    return 0.0;
+
+  for (bin = 0; bin < SMART_STEERING_HISTOGRAM_BINS-1; ++bin) {
+    count += histogram->bins[bin];
+    if (count >= quantile*histogram->count)
+      return fmin((bin+1)*SMART_STEERING_HISTOGRAM_RESOLUTION,
+        histogram->max);
+  }
+
+  return histogram->max;
+}
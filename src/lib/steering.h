@@ -0,0 +1,145 @@
+#ifndef SMART_STEERING_H
+#define SMART_STEERING_H
+
+#include <pthread.h>
+
+#include <libelrob/Etypes.h>
+
+#include "smart.h"
+#include "cst.h"
+
+/*! \defgroup smartlibsteering Fixed-rate steering control loop
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file steering.h
+ *
+ *  \brief Steering control loop executed at a fixed rate
+ *
+ * A thread of the library wakes up on absolute deadlines of the monotonic
+ * clock through clock_nanosleep(), reads the steering angle from a copy of
+ * the vehicle status, runs a steering PID with the nominal period as its
+ * sampling time and sends the voltage to the CST. While the steering angle
+ * is stale, the loop sends CST_PID_NEUTRAL_OUTPUT and resets the PID. The
+ * loop optionally runs with SCHED_FIFO priority and pinned to a CPU.
+ *
+ * Every cycle records its wake-up latency behind the deadline, the
+ * deviation of its period from the nominal one and its compute time in
+ * histograms. A cycle finishing after the next deadline is a deadline
+ * miss, and the periods it overran are skipped instead of being caught up.
+ */
+
+/*! \brief Default rate of the control loop in [Hz] */
+#define SMART_STEERING_RATE 100.0
+/*! \brief Number of bins of the timing histograms, the last one collects
+ * all larger values */
+#define SMART_STEERING_HISTOGRAM_BINS 100
+/*! \brief Width of the bins of the timing histograms in [s] */
+#define SMART_STEERING_HISTOGRAM_RESOLUTION 10e-6
+
+/*! \brief Configuration of the control loop */
+typedef struct SMART_STEERING_CONFIG {
+  int busId; ///< CAN bus the CST is attached to
+  double rate; ///< Rate of the loop in [Hz]
+  SMART_PID_STR gains; ///< P, I and D of the steering PID
+  int priority; ///< SCHED_FIFO priority, 0 for the default scheduling
+  int cpu; ///< CPU the loop is pinned to, -1 for any CPU
+} SMART_STEERING_CONFIG;
+
+/*! \brief Histogram of durations */
+typedef struct SMART_STEERING_HISTOGRAM {
+  unsigned long bins[SMART_STEERING_HISTOGRAM_BINS]; ///< Counts per bin
+  unsigned long count; ///< Number of durations
+  double min; ///< Minimum duration in [s]
+  double max; ///< Maximum duration in [s]
+  double sum; ///< Sum of the durations in [s]
+} SMART_STEERING_HISTOGRAM;
+
+/*! \brief Timing statistics of the control loop */
+typedef struct SMART_STEERING_STATS {
+  unsigned long cycles; ///< Executed cycles
+  unsigned long misses; ///< Cycles finishing after the next deadline
+  unsigned long skipped; ///< Periods skipped after deadline misses
+  unsigned long stale; ///< Cycles sending the neutral voltage, angle stale
+  SMART_STEERING_HISTOGRAM latency; ///< Wake-up behind the deadline
+  SMART_STEERING_HISTOGRAM jitter; ///< Deviation of the period
+  SMART_STEERING_HISTOGRAM compute; ///< Time from wake-up to sent voltage
+} SMART_STEERING_STATS;
+
+/*! \brief Steering control loop */
+typedef struct SMART_STEERING_LOOP {
+  SMART_STEERING_CONFIG config; ///< The configuration
+  SMART_PID pid; ///< The steering PID
+  double target; ///< Desired steering angle in radients at the wheel
+  double voltage; ///< Last voltage sent
+  SMART_STEERING_STATS stats; ///< Timing statistics
+  pthread_mutex_t mutex; ///< Protects the target and the statistics
+  pthread_t thread; ///< The thread of the loop
+  volatile EBOOL running; ///< The loop is running
+} SMART_STEERING_LOOP;
+
+/*!
+ *
+ * \brief Start a steering control loop
+ *
+ * If the SCHED_FIFO priority or the CPU affinity cannot be set, e.g. for
+ * lack of privileges, the loop is started with the default scheduling.
+ *
+ * \param loop The loop
+ * \param config The configuration
+ * \return 0 on success, -1 on failure
+ *
+ */
+int smartSteeringStart(SMART_STEERING_LOOP *loop,
+  const SMART_STEERING_CONFIG *config);
+
+/*!
+ *
+ * \brief Stop a steering control loop
+ *
+ */
+void smartSteeringStop(SMART_STEERING_LOOP *loop);
+
+/*!
+ *
+ * \brief Set the desired steering angle
+ *
+ * \param angle Desired steering angle in radients at the wheel
+ *
+ */
+void smartSteeringSetTarget(SMART_STEERING_LOOP *loop, double angle);
+
+/*!
+ *
+ * \brief Copy of the timing statistics
+ *
+ */
+void smartSteeringGetStats(SMART_STEERING_LOOP *loop,
+  SMART_STEERING_STATS *stats);
+
+/*!
+ *
+ * \brief Reset the timing statistics
+ *
+ */
+void smartSteeringResetStats(SMART_STEERING_LOOP *loop);
+
+/*!
+ *
+ * \brief Duration below which a fraction of a histogram's durations lie
+ *
+ * The result is the upper edge of the bin holding the quantile, or the
+ * maximum if the quantile lies in the last bin.
+ *
+ * \param quantile Fraction in [0, 1], e.g. 0.99
+ * \return The duration in [s], 0 if the histogram is empty
+ *
+ */
+double smartSteeringQuantile(const SMART_STEERING_HISTOGRAM *histogram,
+  double quantile);
+
+/*@}*/
+#endif
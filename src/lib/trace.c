@@ -0,0 +1,318 @@
+/*!
+ *  \file trace.c
+ *
+ *  \brief Recording of all CAN traffic into a compact binary file
+ *
+ * Records are appended to one of two preallocated buffers under a mutex
+ * which is never held across a system call. Once a buffer is full, or
+ * after CAN_TRACE_FLUSH_PERIOD, the buffers are swapped and the flush
+ * thread writes the full one while the other one is being filled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <libelrob/Edebug.h>
+
+#include "can.h"
+#include "trace.h"
+
+/*! \brief State of the trace recorder */
+typedef struct CAN_TRACE {
+  int fd; ///< The trace file
+  CAN_TRACE_RECORD *buffers[2]; ///< The double buffer
+  unsigned int size; ///< Number of records per buffer
+  int current; ///< Index of the buffer being filled
+  unsigned int fill; ///< Number of records in the current buffer
+  int pending; ///< Index of the buffer to be written, -1 if none
+  unsigned int pending_fill; ///< Number of records in the pending buffer
+  pthread_mutex_t mutex; ///< Protects the buffers
+  pthread_cond_t cond; ///< Signals pending buffers to the flush thread
+  pthread_t flusher; ///< The flush thread
+  volatile EBOOL active; ///< Records are accepted
+  CAN_TRACE_STATS stats; ///< Statistics
+} CAN_TRACE;
+
+/* The mutex and the condition are never destroyed, such that recorders
+   may check the state of the trace at any time */
+static CAN_TRACE can_trace = {
+  .fd = -1,
+  .pending = -1,
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/*!
+ *
+ * \brief hands the current buffer to the flush thread
+ *
+ * Must be called with the mutex held and no buffer pending.
+ *
+ */
+static void trace_swap(CAN_TRACE *trace)
+{
+  trace->pending = trace->current;
+  trace->pending_fill = trace->fill;
+  trace->current ^= 1;
+  trace->fill = 0;
+  pthread_cond_signal(&trace->cond);
+}
+
+/*!
+ *
+ * \brief writes a block of data, resuming after interrupted writes
+ *
+ */
+static int trace_write(int fd, const void *data, size_t size)
+{
+  const char *pos = data;
+  ssize_t result;
+
+  while (size > 0) {
+    if ((result = write(fd, pos, size)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    pos += result;
+    size -= result;
+  }
+
+  return 0;
+}
+
+/*!
+ *
+ * \brief flush thread writing pending buffers to the trace file
+ *
+ */
+static void* trace_flusher(void *arg)
+{
+  CAN_TRACE *trace = arg;
+  struct timespec timeout;
+  EBOOL running = ETRUE;
+  int pending;
+  unsigned int fill;
+
+  pthread_mutex_lock(&trace->mutex);
+  while (running) {
+    if (trace->pending < 0) {
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_sec += (time_t)CAN_TRACE_FLUSH_PERIOD;
+      if (trace->active)
+        pthread_cond_timedwait(&trace->cond, &trace->mutex, &timeout);
+
+      /* Partially filled buffers are written periodically and on close */
+      running = trace->active;
+      if ((trace->pending < 0) && trace->fill)
+        trace_swap(trace);
+      if (trace->pending < 0)
+        continue;
+    }
+
+    pending = trace->pending;
+    fill = trace->pending_fill;
+    pthread_mutex_unlock(&trace->mutex);
+
+    if (trace_write(trace->fd, trace->buffers[pending],
+        fill*sizeof(CAN_TRACE_RECORD))) {
+      ++trace->stats.write_errors;
+      perror("trace");
+    }
+    else
+      ++trace->stats.flushes;
+
+    pthread_mutex_lock(&trace->mutex);
+    trace->pending = -1;
+  }
+  pthread_mutex_unlock(&trace->mutex);
+
+  return 0;
+}
+
+int canTraceInit(const SMART_CONFIG_STR *config)
+{
+  if (!config->log)
+    return 0;
+
+  return canTraceOpen(config->logfile, 0);
+}
+
+int canTraceOpen(const char *filename, unsigned int size)
+{
+  CAN_TRACE *trace = &can_trace;
+  CAN_TRACE_HEADER header;
+  CAN_TRACE_RECORD *buffer;
+  struct timeval time;
+  int fd;
+
+  if (trace->active) {
+    EDBG("ERROR: a trace is already being recorded\n");
+    return -1;
+  }
+  if (!size)
+    size = CAN_TRACE_BUFFER_SIZE;
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(filename);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CAN_TRACE_MAGIC, sizeof(header.magic));
+  header.version = CAN_TRACE_VERSION;
+  header.record_size = sizeof(CAN_TRACE_RECORD);
+  gettimeofday(&time, 0);
+  header.start_time = canGetTime();
+  header.start_realtime = time.tv_sec+time.tv_usec*1e-6;
+  if (trace_write(fd, &header, sizeof(header)) ||
+      !(buffer = malloc(2*size*sizeof(CAN_TRACE_RECORD)))) {
+    perror(filename);
+    close(fd);
+    return -1;
+  }
+
+  pthread_mutex_lock(&trace->mutex);
+  if (trace->active) {
+    pthread_mutex_unlock(&trace->mutex);
+    EDBG("ERROR: a trace is already being recorded\n");
+    free(buffer);
+    close(fd);
+    return -1;
+  }
+  trace->fd = fd;
+  trace->buffers[0] = buffer;
+  trace->buffers[1] = buffer+size;
+  trace->size = size;
+  trace->current = 0;
+  trace->fill = 0;
+  trace->pending = -1;
+  memset(&trace->stats, 0, sizeof(CAN_TRACE_STATS));
+
+  trace->active = ETRUE;
+  if (pthread_create(&trace->flusher, 0, trace_flusher, trace)) {
+    trace->active = EFALSE;
+    trace->buffers[0] = trace->buffers[1] = 0;
+    trace->fd = -1;
+    pthread_mutex_unlock(&trace->mutex);
+    free(buffer);
+    close(fd);
+    return -1;
+  }
+  pthread_mutex_unlock(&trace->mutex);
+
+  EDBG("Recording CAN trace to %s\n", filename);
+  return 0;
+}
+
+void canTraceClose(void)
+{
+  CAN_TRACE *trace = &can_trace;
+  CAN_TRACE_RECORD *buffer, *last;
+  unsigned int fill;
+
+  pthread_mutex_lock(&trace->mutex);
+  if (!trace->active) {
+    pthread_mutex_unlock(&trace->mutex);
+    return;
+  }
+  trace->active = EFALSE;
+  pthread_cond_signal(&trace->cond);
+  pthread_mutex_unlock(&trace->mutex);
+  pthread_join(trace->flusher, 0);
+
+  /* Recorders check the state under the mutex, the buffers are released
+     once no recorder can access them anymore */
+  pthread_mutex_lock(&trace->mutex);
+  buffer = trace->buffers[0];
+  last = trace->buffers[trace->current];
+  fill = trace->fill;
+  trace->buffers[0] = trace->buffers[1] = 0;
+  trace->fill = 0;
+  pthread_mutex_unlock(&trace->mutex);
+
+  /* The last buffer may have been filled while the other one was written */
+  if (fill && trace_write(trace->fd, last, fill*sizeof(CAN_TRACE_RECORD)))
+    ++trace->stats.write_errors;
+
+  free(buffer);
+  close(trace->fd);
+  trace->fd = -1;
+
+  EDBG("CAN trace: %lu records, %lu dropped\n", trace->stats.records,
+    trace->stats.dropped);
+}
+
+EBOOL canTraceActive(void)
+{
+  return can_trace.active;
+}
+
+void canTraceRecord(int busId, int flags, double timestamp, unsigned int id,
+  int length, const unsigned char *data)
+{
+  CAN_TRACE *trace = &can_trace;
+  CAN_TRACE_RECORD *record;
+
+  /* Unlocked hint only, the state is checked again under the mutex */
+  if (!trace->active)
+    return;
+
+  pthread_mutex_lock(&trace->mutex);
+  if (!trace->active) {
+    pthread_mutex_unlock(&trace->mutex);
+    return;
+  }
+  if (trace->fill == trace->size) {
+    if (trace->pending >= 0) {
+      ++trace->stats.dropped;
+      pthread_mutex_unlock(&trace->mutex);
+      return;
+    }
+    trace_swap(trace);
+  }
+
+  record = &trace->buffers[trace->current][trace->fill++];
+  record->timestamp = timestamp;
+  record->id = id;
+  record->busId = busId;
+  record->flags = flags;
+  record->length = (length > 8) ? 8 : length;
+  record->reserved = 0;
+  memset(record->data, 0, sizeof(record->data));
+  memcpy(record->data, data, record->length);
+
+  ++trace->stats.records;
+  if (trace->fill > trace->stats.max_fill)
+    trace->stats.max_fill = trace->fill;
+  pthread_mutex_unlock(&trace->mutex);
+}
+
+void canTraceMessage(int busId, const CPC_MSG_T *cpcmsg)
+{
+  int flags = 0;
+
+  if ((cpcmsg->type == CPC_MSG_T_XCAN) || (cpcmsg->type == CPC_MSG_T_XRTR))
+    flags |= CAN_TRACE_EXTENDED;
+  if ((cpcmsg->type == CPC_MSG_T_RTR) || (cpcmsg->type == CPC_MSG_T_XRTR))
+    flags |= CAN_TRACE_RTR;
+  else if ((cpcmsg->type != CPC_MSG_T_CAN) &&
+      (cpcmsg->type != CPC_MSG_T_XCAN))
+    return;
+
+  canTraceRecord(busId, flags, canGetTimestamp(cpcmsg),
+    cpcmsg->msg.canmsg.id, cpcmsg->msg.canmsg.length,
+    cpcmsg->msg.canmsg.msg);
+}
+
+void canTraceGetStats(CAN_TRACE_STATS *stats)
+{
+  *stats = can_trace.stats;
+}
@@ -0,0 +1,140 @@
+#ifndef SMART_TRACE_H
+#define SMART_TRACE_H
+
+#include <libcpc/cpclib.h>
+#include <libelrob/Etypes.h>
+
+#include "smart.h"
+
+/*! \defgroup smartlibtrace Binary CAN trace recorder
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file trace.h
+ *
+ *  \brief Recording of all CAN traffic into a compact binary file
+ *
+ * A trace file starts with a CAN_TRACE_HEADER followed by one
+ * CAN_TRACE_RECORD per received or sent message. Records are appended to
+ * a preallocated double buffer and written to disk by a background
+ * thread, such that neither the receive path nor the senders ever wait
+ * for the disk. Records are dropped only if a complete buffer fills up
+ * while the other one is still being written.
+ */
+
+/*! \brief Magic string at the beginning of a trace file */
+#define CAN_TRACE_MAGIC "CANTRACE"
+/*! \brief Version of the trace file format */
+#define CAN_TRACE_VERSION 1
+/*! \brief Default number of records per trace buffer */
+#define CAN_TRACE_BUFFER_SIZE 65536
+/*! \brief Maximum delay before buffered records are written in [s] */
+#define CAN_TRACE_FLUSH_PERIOD 1.0
+
+/*! \brief The message was sent, not received */
+#define CAN_TRACE_TX 0x01
+/*! \brief The message has an extended (29 bit) identifier */
+#define CAN_TRACE_EXTENDED 0x02
+/*! \brief The message is a remote transmission request */
+#define CAN_TRACE_RTR 0x04
+
+/*! \brief Header of a trace file */
+typedef struct CAN_TRACE_HEADER {
+  char magic[8]; ///< CAN_TRACE_MAGIC, not null-terminated
+  unsigned int version; ///< CAN_TRACE_VERSION
+  unsigned int record_size; ///< Size of a record in bytes
+  double start_time; ///< Monotonic time at the start of the recording
+  double start_realtime; ///< Wall clock time at the start of the recording
+} CAN_TRACE_HEADER;
+
+/*! \brief Record of a CAN message, 24 bytes */
+typedef struct CAN_TRACE_RECORD {
+  double timestamp; ///< Monotonic receive or send time in [s]
+  unsigned int id; ///< Identifier of the message
+  unsigned char busId; ///< CAN bus the message was seen on
+  unsigned char flags; ///< Combination of CAN_TRACE_TX, CAN_TRACE_EXTENDED, CAN_TRACE_RTR
+  unsigned char length; ///< Length of the message
+  unsigned char reserved;
+  unsigned char data[8]; ///< Content of the message
+} CAN_TRACE_RECORD;
+
+/*! \brief Statistics of the trace recorder */
+typedef struct CAN_TRACE_STATS {
+  unsigned long records; ///< Records appended to the buffer
+  unsigned long dropped; ///< Records dropped due to full buffers
+  unsigned long flushes; ///< Buffers written to disk
+  unsigned long write_errors; ///< Failed writes
+  unsigned int max_fill; ///< Maximum number of records in a buffer
+} CAN_TRACE_STATS;
+
+/*!
+ *
+ * \brief Start recording according to the global configuration
+ *
+ * Recording starts if config->log is set, the trace is written to
+ * config->logfile.
+ *
+ * \return 0 if recording started or is not configured, -1 on failure
+ *
+ */
+int canTraceInit(const SMART_CONFIG_STR *config);
+
+/*!
+ *
+ * \brief Start recording into a trace file
+ *
+ * \param filename Name of the trace file, an existing file is replaced
+ * \param size Number of records per buffer, 0 for CAN_TRACE_BUFFER_SIZE
+ * \return 0 on success, -1 on failure
+ *
+ */
+int canTraceOpen(const char *filename, unsigned int size);
+
+/*!
+ *
+ * \brief Stop recording and write all buffered records
+ *
+ */
+void canTraceClose(void);
+
+/*!
+ *
+ * \brief Is a trace being recorded?
+ *
+ */
+EBOOL canTraceActive(void);
+
+/*!
+ *
+ * \brief Append a message to the trace
+ *
+ * This function may be called from any thread. It never waits for the
+ * disk and returns immediately if no trace is being recorded.
+ *
+ * \param busId CAN bus the message was seen on
+ * \param flags Combination of CAN_TRACE_TX, CAN_TRACE_EXTENDED, CAN_TRACE_RTR
+ * \param timestamp Monotonic receive or send time in [s]
+ *
+ */
+void canTraceRecord(int busId, int flags, double timestamp, unsigned int id,
+  int length, const unsigned char *data);
+
+/*!
+ *
+ * \brief Append a received message to the trace
+ *
+ */
+void canTraceMessage(int busId, const CPC_MSG_T *cpcmsg);
+
+/*!
+ *
+ * \brief Statistics of the current or last recording
+ *
+ */
+void canTraceGetStats(CAN_TRACE_STATS *stats);
+
+/*@}*/
+#endif
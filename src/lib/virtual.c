@@ -0,0 +1,335 @@
+/*!
+ *  \file virtual.c
+ *
+ *  \brief In-process virtual CAN networks for testing without hardware
+ *
+ * Every attached bus owns a FIFO of messages in flight together with the
+ * times they are due. Since the network transmits one message at a time,
+ * these times never decrease, and a timer descriptor armed to the due time
+ * of the oldest message signals the receiver. Due times refer to
+ * canGetTime(), which may be a simulated clock, so the timer is armed with
+ * the remaining delay rather than an absolute monotonic time. All queues
+ * of a network are protected by the network's mutex, which is released
+ * before any message is passed to the handlers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include <libelrob/Edebug.h>
+
+#include "virtual.h"
+
+/*! Number of messages passed to the handlers per locking of a network */
+#define VIRTUAL_BATCH 64
+
+/*! \brief Message in flight */
+typedef struct CAN_VIRTUAL_FRAME {
+  CPC_CAN_MSG_T message; ///< The message
+  double due; ///< Time of canGetTime() at which the message is received
+} CAN_VIRTUAL_FRAME;
+
+/*! \brief Virtual network */
+typedef struct CAN_VIRTUAL_NET {
+  char name[32]; ///< Name of the network
+  CAN_VIRTUAL_CONFIG config; ///< Parameters
+  double busy_until; ///< End of the transmission of the last message
+  CAN_VIRTUAL_STATS stats; ///< Statistics
+  pthread_mutex_t mutex; ///< Protects the network and its ports
+} CAN_VIRTUAL_NET;
+
+/*! \brief Attachment of a bus to a virtual network */
+typedef struct CAN_VIRTUAL_PORT {
+  CAN_BUS *bus; ///< The attached bus, 0 if unused
+  CAN_VIRTUAL_NET *net; ///< The network
+  int fd; ///< Timer descriptor signaling due messages
+  CAN_VIRTUAL_FRAME queue[CAN_VIRTUAL_QUEUE_SIZE]; ///< Messages in flight
+  unsigned int head; ///< Next message to be received
+  unsigned int tail; ///< Next free queue entry
+} CAN_VIRTUAL_PORT;
+
+static CAN_VIRTUAL_NET can_virtual_nets[CAN_VIRTUAL_MAX_NETS];
+static int can_virtual_num_nets = 0;
+static pthread_mutex_t can_virtual_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static CAN_VIRTUAL_PORT can_virtual_ports[LIBCAN_MAX_CAN];
+
+/*!
+ *
+ * \brief finds or creates a network
+ *
+ * Must be called with can_virtual_mutex held.
+ *
+ */
+static CAN_VIRTUAL_NET* virtual_get_net(const char *name, EBOOL create)
+{
+  CAN_VIRTUAL_NET *net;
+  int i;
+
+  for (i = 0; i < can_virtual_num_nets; ++i)
+    if (!strncmp(can_virtual_nets[i].name, name,
+        sizeof(can_virtual_nets[i].name)-1))
+      return &can_virtual_nets[i];
+  if (!create || (can_virtual_num_nets == CAN_VIRTUAL_MAX_NETS))
+    return 0;
+
+  net = &can_virtual_nets[can_virtual_num_nets++];
+  memset(net, 0, sizeof(CAN_VIRTUAL_NET));
+  strncpy(net->name, name, sizeof(net->name)-1);
+  pthread_mutex_init(&net->mutex, 0);
+
+  return net;
+}
+
+/*!
+ *
+ * \brief arms the timer of a port to the due time of its oldest message
+ *
+ * Messages already due fire the timer immediately. Must be called with the
+ * network's mutex held.
+ *
+ */
+static void virtual_arm(CAN_VIRTUAL_PORT *port)
+{
+  struct itimerspec spec;
+  double delay;
+
+  memset(&spec, 0, sizeof(spec));
+  if (port->head != port->tail) {
+    delay = port->queue[port->head % CAN_VIRTUAL_QUEUE_SIZE].due-
+      canGetTime();
+    if (delay > 0.0) {
+      spec.it_value.tv_sec = (time_t)delay;
+      spec.it_value.tv_nsec = (delay-spec.it_value.tv_sec)*1e9;
+    }
+    /* A zero value would disarm the timer */
+    if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+      spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(port->fd, 0, &spec, 0);
+}
+
+/*!
+ *
+ * \brief checks a message against the acceptance filter of a bus
+ *
+ */
+static EBOOL virtual_accept(const CAN_BUS *bus, int can_id)
+{
+  int i;
+
+  if (!bus->filter_set)
+    return ETRUE;
+  for (i = 0; i < bus->num_filter_ids; ++i)
+    if (bus->filter_ids[i] == can_id)
+      return ETRUE;
+
+  return EFALSE;
+}
+
+int canVirtualConfigure(const char *network, const CAN_VIRTUAL_CONFIG *config)
+{
+  CAN_VIRTUAL_NET *net;
+
+  pthread_mutex_lock(&can_virtual_mutex);
+  if ((net = virtual_get_net(network, ETRUE))) {
+    pthread_mutex_lock(&net->mutex);
+    net->config = *config;
+    pthread_mutex_unlock(&net->mutex);
+  }
+  pthread_mutex_unlock(&can_virtual_mutex);
+
+  return net ? 0 : -1;
+}
+
+int canVirtualGetStats(const char *network, CAN_VIRTUAL_STATS *stats)
+{
+  CAN_VIRTUAL_NET *net;
+
+  pthread_mutex_lock(&can_virtual_mutex);
+  if ((net = virtual_get_net(network, EFALSE))) {
+    pthread_mutex_lock(&net->mutex);
+    *stats = net->stats;
+    pthread_mutex_unlock(&net->mutex);
+  }
+  pthread_mutex_unlock(&can_virtual_mutex);
+
+  return net ? 0 : -1;
+}
+
+int canVirtualOpen(CAN_BUS *bus, int bitrate)
+{
+  CAN_VIRTUAL_PORT *port = &can_virtual_ports[bus->busId];
+  CAN_VIRTUAL_NET *net;
+  int fd;
+
+  if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+    perror("timerfd_create");
+    return -1;
+  }
+
+  pthread_mutex_lock(&can_virtual_mutex);
+  if (!(net = virtual_get_net(bus->device, EFALSE)) &&
+      (net = virtual_get_net(bus->device, ETRUE)))
+    net->config.bitrate = bitrate;
+  pthread_mutex_unlock(&can_virtual_mutex);
+  if (!net) {
+    EDBG("ERROR: too many virtual CAN networks\n");
+    close(fd);
+    return -1;
+  }
+
+  pthread_mutex_lock(&net->mutex);
+  port->net = net;
+  port->fd = fd;
+  port->head = 0;
+  port->tail = 0;
+  port->bus = bus;
+  pthread_mutex_unlock(&net->mutex);
+
+  return fd;
+}
+
+int canVirtualClose(CAN_BUS *bus)
+{
+  CAN_VIRTUAL_PORT *port = &can_virtual_ports[bus->busId];
+  CAN_VIRTUAL_NET *net = port->net;
+
+  if (!port->bus)
+    return -1;
+
+  pthread_mutex_lock(&net->mutex);
+  port->bus = 0;
+  pthread_mutex_unlock(&net->mutex);
+
+  return close(port->fd);
+}
+
+int canVirtualSend(CAN_BUS *bus, int can_id, int length, const char *msg)
+{
+  CAN_VIRTUAL_PORT *port = &can_virtual_ports[bus->busId], *receiver;
+  CAN_VIRTUAL_NET *net = port->net;
+  CAN_VIRTUAL_FRAME *frame;
+  double now = canGetTime(), duration = 0.0, due;
+  int i;
+
+  pthread_mutex_lock(&net->mutex);
+  if (net->busy_until < now)
+    net->busy_until = now;
+  else if (net->busy_until-now > LIBCAN_TIMEOUT) {
+    pthread_mutex_unlock(&net->mutex);
+    ++bus->stats.tx_timeouts;
+    return -1;
+  }
+
+  /* Nominal length of a standard data frame, without stuff bits */
+  if (net->config.bitrate > 0)
+    duration = (47+8*length)/(net->config.bitrate*1e3);
+  net->busy_until += duration;
+  net->stats.busy_time += duration;
+  ++net->stats.frames;
+
+  if ((net->config.drop_probability > 0.0) &&
+      (rand_r(&net->config.seed) < net->config.drop_probability*RAND_MAX)) {
+    ++net->stats.dropped;
+    pthread_mutex_unlock(&net->mutex);
+    return 0;
+  }
+
+  due = net->busy_until+net->config.latency;
+  for (i = 0; i < LIBCAN_MAX_CAN; ++i) {
+    receiver = &can_virtual_ports[i];
+    if ((receiver->net != net) || !receiver->bus ||
+        ((receiver == port) && !net->config.loopback) ||
+        !virtual_accept(receiver->bus, can_id))
+      continue;
+
+    if (receiver->tail-receiver->head == CAN_VIRTUAL_QUEUE_SIZE) {
+      ++net->stats.overruns;
+      ++receiver->bus->stats.rx_overruns;
+      continue;
+    }
+
+    frame = &receiver->queue[receiver->tail % CAN_VIRTUAL_QUEUE_SIZE];
+    frame->message.id = can_id;
+    frame->message.length = length;
+    memcpy(frame->message.msg, msg, length);
+    frame->due = due;
+    if (receiver->tail++ == receiver->head)
+      virtual_arm(receiver);
+  }
+  pthread_mutex_unlock(&net->mutex);
+
+  return 0;
+}
+
+EBOOL canVirtualProcess(CAN_BUS *bus)
+{
+  CAN_VIRTUAL_PORT *port = &can_virtual_ports[bus->busId];
+  CAN_VIRTUAL_FRAME frames[VIRTUAL_BATCH];
+  CPC_MSG_T cpcmsg;
+  unsigned long long expirations;
+  double now;
+  int i, count;
+  EBOOL result = EFALSE;
+
+  if (!port->bus)
+    return EFALSE;
+  if (read(port->fd, &expirations, sizeof(expirations)) < 0)
+    expirations = 0;
+
+  memset(&cpcmsg, 0, sizeof(cpcmsg));
+  cpcmsg.type = CPC_MSG_T_CAN;
+  cpcmsg.length = sizeof(CPC_CAN_MSG_T);
+
+  do {
+    now = canGetTime();
+    pthread_mutex_lock(&port->net->mutex);
+    for (count = 0; (count < VIRTUAL_BATCH) && (port->head != port->tail) &&
+        (port->queue[port->head % CAN_VIRTUAL_QUEUE_SIZE].due <= now);
+        ++count)
+      frames[count] = port->queue[port->head++ % CAN_VIRTUAL_QUEUE_SIZE];
+    virtual_arm(port);
+    pthread_mutex_unlock(&port->net->mutex);
+
+    for (i = 0; i < count; ++i) {
+      cpcmsg.ts_sec = (long)frames[i].due;
+      cpcmsg.ts_nsec = (frames[i].due-cpcmsg.ts_sec)*1e9;
+      cpcmsg.msg.canmsg = frames[i].message;
+      canBusReceive(bus, &cpcmsg);
+      result = ETRUE;
+    }
+  }
+  while (count == VIRTUAL_BATCH);
+
+  return result;
+}
+
+EBOOL canVirtualRead(CAN_BUS *bus)
+{
+  struct pollfd pfd;
+  int result;
+
+  pfd.fd = can_virtual_ports[bus->busId].fd;
+  pfd.events = POLLIN;
+
+  if ((result = poll(&pfd, 1, LIBCAN_READ_TIMEOUT*1e3)) > 0)
+    return canVirtualProcess(bus);
+
+  if (result < 0) {
+    if (errno != EINTR) {
+      ++bus->stats.rx_errors;
+      perror(bus->device);
+    }
+  }
+  else
+    EDBG("nothing to read...from can bus %d\n", bus->busId);
+
+  return EFALSE;
+}
@@ -0,0 +1,120 @@
+#ifndef SMART_VIRTUAL_H
+#define SMART_VIRTUAL_H
+
+#include <libelrob/Etypes.h>
+
+#include "can.h"
+
+/*! \defgroup smartlibvirtual In-process virtual CAN busses
+* \ingroup smartlibs
+*/
+
+/*@{*/
+
+/*!
+ *  \file virtual.h
+ *
+ *  \brief In-process virtual CAN networks for testing without hardware
+ *
+ * CAN busses initialized with the communication type SMART_CAN_COM_VIRTUAL
+ * are attached to an in-memory network named by their device string. All
+ * busses attached to the same network receive each other's messages,
+ * delayed by the transmission time at the network's bitrate and by a
+ * configurable latency, and possibly lost with a configurable
+ * probability. The descriptor returned by canHWGetFd() becomes readable
+ * when messages are due, so virtual busses may be served by the reactor
+ * like real ones.
+ */
+
+/*! \brief Maximum number of virtual networks */
+#define CAN_VIRTUAL_MAX_NETS LIBCAN_MAX_CAN
+/*! \brief Number of messages in flight per receiving bus */
+#define CAN_VIRTUAL_QUEUE_SIZE 1024
+
+/*! \brief Parameters of a virtual network */
+typedef struct CAN_VIRTUAL_CONFIG {
+  double latency; ///< Delay added to the transmission time in [s]
+  int bitrate; ///< Bitrate in Kbaud, 0 for unlimited bandwidth
+  double drop_probability; ///< Probability of a message getting lost
+  EBOOL loopback; ///< Senders receive their own messages
+  unsigned int seed; ///< Seed of the random message losses
+} CAN_VIRTUAL_CONFIG;
+
+/*! \brief Statistics of a virtual network */
+typedef struct CAN_VIRTUAL_STATS {
+  unsigned long frames; ///< Messages sent on the network
+  unsigned long dropped; ///< Messages lost on purpose
+  unsigned long overruns; ///< Messages lost due to full receive queues
+  double busy_time; ///< Transmission time of all messages in [s]
+} CAN_VIRTUAL_STATS;
+
+/*!
+ *
+ * \brief Configure a virtual network
+ *
+ * Networks which are not configured before the first bus is attached
+ * take the bitrate of that bus and have neither latency nor losses.
+ *
+ * \param network Name of the network, the device string of its busses
+ * \return 0 on success, -1 if there are too many networks
+ *
+ */
+int canVirtualConfigure(const char *network, const CAN_VIRTUAL_CONFIG *config);
+
+/*!
+ *
+ * \brief Statistics of a virtual network
+ *
+ * \return 0 on success, -1 if there is no such network
+ *
+ */
+int canVirtualGetStats(const char *network, CAN_VIRTUAL_STATS *stats);
+
+/*!
+ *
+ * \brief Attach a bus context to the virtual network named by its device
+ *
+ * \param bitrate Bitrate of the network if it is not configured yet
+ * \return The descriptor signaling due messages or -1 on failure
+ *
+ */
+int canVirtualOpen(CAN_BUS *bus, int bitrate);
+
+/*!
+ *
+ * \brief Detach a bus context from its virtual network
+ *
+ * Messages in flight to the bus are discarded.
+ *
+ */
+int canVirtualClose(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief Send a message on a virtual network
+ *
+ * The message occupies the network for its transmission time. If the
+ * messages waiting for transmission would delay it by more than
+ * LIBCAN_TIMEOUT, it is rejected.
+ *
+ * \return 0 on success, -1 on timeout
+ *
+ */
+int canVirtualSend(CAN_BUS *bus, int can_id, int length, const char *msg);
+
+/*!
+ *
+ * \brief Wait for at most LIBCAN_READ_TIMEOUT and receive all due messages
+ *
+ */
+EBOOL canVirtualRead(CAN_BUS *bus);
+
+/*!
+ *
+ * \brief Receive all due messages without waiting
+ *
+ */
+EBOOL canVirtualProcess(CAN_BUS *bus);
+
+/*@}*/
+#endif